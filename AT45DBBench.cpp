@@ -0,0 +1,147 @@
+/* 
+ * @file    AT45DBBench.cpp
+ * @brief   Device driver - AT45DB benchmark program, host simulator or target
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+/*
+ * Benchmark entry point.
+ *
+ * Host, against the simulator with its modelled clock:
+ *
+ *   g++ -O2 -I. AT45DBBench.cpp AT45DBSim.cpp -o at45bench && ./at45bench
+ *
+ * -DAT45_BENCH_CALL_NS=n charges n ns for each SPI transfer call, and 
+ * -DAT45_BENCH_BYTEWISE=1 makes one call per byte, as the driver did 
+ * before block transfers. At 8MHz with 2500ns per call (under 30% bus
+ * use per byte, as seen on target) a 512-byte page measures:
+ *
+ *                      per byte            block transfers
+ *   read page          1820us  0.281MB/s   525us   0.975MB/s
+ *   buffer write       1806us  0.283MB/s   521us   0.982MB/s
+ *   writepage          3858us  0.132MB/s   2556us  0.200MB/s   (no erase, to ready)
+ *
+ * Target: build with AT45DB_BENCH defined (e.g. in mbed_app.json macros)
+ * and the pins in AT45_BENCH_PINS; time is taken from a Timer. Without
+ * AT45DB_BENCH this file compiles to nothing on mbed, so it does not 
+ * clash with the application's main().
+ */
+
+#if defined(__MBED__)
+
+#if defined(AT45DB_BENCH)
+
+#include "AT45DB.h"
+#include "AT45DBBench.h"
+
+#ifndef AT45_BENCH_PINS
+#define AT45_BENCH_PINS     SPI_MOSI, SPI_MISO, SPI_SCK, SPI_CS
+#endif  // AT45_BENCH_PINS
+
+/*
+ * Timer as a benchmark clock
+ */
+class AT45DBBenchTimer
+{
+
+public:
+
+    AT45DBBenchTimer()
+    {
+        _timer.start();
+    }
+
+    uint64_t now_ns(void)
+    {
+        return (uint64_t)_timer.read_high_resolution_us() * 1000;
+    }
+
+private:
+
+    Timer           _timer;
+
+};
+
+static AT45DB                                   flash(AT45_BENCH_PINS);
+static AT45DBBenchTimer                         timer;
+static AT45DBBench<AT45DBMbedBus, AT45DBBenchTimer>  bench(flash, timer);
+
+int main()
+{
+    printf("AT45DB benchmark, SPI %d Hz, on target\n", AT45_SPI_FREQ);
+    bench.run();
+    return 0;
+}
+
+#endif  // AT45DB_BENCH
+
+#else
+
+#include "AT45DBCore.h"
+#include "AT45DBSimBus.h"
+#include "AT45DBBench.h"
+
+#ifndef AT45_BENCH_CALL_NS
+#define AT45_BENCH_CALL_NS      0               // modelled HAL cost of each SPI transfer call
+#endif  // AT45_BENCH_CALL_NS
+#ifndef AT45_BENCH_BYTEWISE
+#define AT45_BENCH_BYTEWISE     0               // one transfer call per byte, as before block transfers
+#endif  // AT45_BENCH_BYTEWISE
+
+#if AT45_BENCH_BYTEWISE
+/*
+ * The simulator bus with every transfer split into single bytes, so
+ * each byte pays the call cost: the driver as it was when it clocked
+ * pages through _at45spi.write() one byte at a time.
+ */
+class AT45DBBenchByteBus : public AT45DBSimBus
+{
+
+public:
+
+    AT45DBBenchByteBus(AT45DBSim &sim, uint32_t call_ns) : AT45DBSimBus(sim, call_ns) { }
+
+    void transfer(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len)
+    {
+        uint32_t    i;
+
+        for (i=0; (i<tx_len) || (i<rx_len); i++) {
+            AT45DBSimBus::transfer((i < tx_len) ? &tx[i] : NULL, (i < tx_len) ? 1 : 0, 
+                                   (i < rx_len) ? &rx[i] : NULL, (i < rx_len) ? 1 : 0);
+        }
+    }
+
+};
+typedef AT45DBBenchByteBus  AT45DBBenchBus;
+#else
+typedef AT45DBSimBus        AT45DBBenchBus;
+#endif  // AT45_BENCH_BYTEWISE
+
+static AT45DBSim                                sim(AT45_SPI_FREQ);
+static AT45DBCore<AT45DBBenchBus>               flash(sim, AT45_BENCH_CALL_NS);
+static AT45DBBench<AT45DBBenchBus, AT45DBSim>   bench(flash, sim);
+
+int main()
+{
+    printf("AT45DB benchmark, SPI %d Hz, simulated, %d ns per transfer call%s\n", AT45_SPI_FREQ, 
+           AT45_BENCH_CALL_NS, AT45_BENCH_BYTEWISE ? ", bytewise" : "");
+    bench.run();
+    return 0;
+}
+
+#endif  // __MBED__
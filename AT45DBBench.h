@@ -0,0 +1,346 @@
+/* 
+ * @file    AT45DBBench.h
+ * @brief   Device driver - AT45DB throughput and latency benchmarks
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBBENCH_H_
+#define _AT45DBBENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "AT45DBCore.h"
+
+#ifndef AT45_BENCH_OPS
+#define AT45_BENCH_OPS          1000            // operations per scenario (latency samples kept)
+#endif  // AT45_BENCH_OPS
+#ifndef AT45_BENCH_PAGES
+#define AT45_BENCH_PAGES        1024            // pages in the scratch area, at the end of the array
+#endif  // AT45_BENCH_PAGES
+#ifndef AT45_BENCH_CHIP_ERASE
+#define AT45_BENCH_CHIP_ERASE   0               // include a (22s typical) chip erase
+#endif  // AT45_BENCH_CHIP_ERASE
+
+/**
+ * Benchmark scenarios for an AT45DBCore on any bus
+ *
+ * Each scenario times every operation individually on 'Clock', an 
+ * object with a uint64_t now_ns(void) method: the AT45DBSim itself for
+ * the modelled clock on a host, or a Timer wrapper on target. Write 
+ * and erase operations are timed to completion (ready). Results are 
+ * printed one line per scenario:
+ *
+ *   scenario, operations, MB/s (10^6 bytes), ops/s, p50 / p99 / p999 latency in us
+ *
+ * The scratch area, the last AT45_BENCH_PAGES pages (or the upper half 
+ * of a smaller part), is erased and overwritten, and run() ends with the device in its 
+ * normal (not powered down) state. Only integer printf is used.
+ *
+ * The object holds the samples and page buffers (about 8.5KB with the
+ * defaults), so on target declare it static rather than on a stack.
+ */
+template <class Bus, class Clock>
+class AT45DBBench
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device under test
+     * @param clock = time source
+     */
+    AT45DBBench(AT45DBCore<Bus> &flash, Clock &clock) : 
+            _flash(flash), _clock(clock), _count(0), _errors(0), _seed(1) { }
+
+    ~AT45DBBench() { }
+
+    /*
+     * Run all scenarios in an order that sets up each one's precondition
+     */
+    void run(void)
+    {
+        uint32_t    blk_pages = _flash.at45_block_pages();
+        uint32_t    sec_pages = _flash.at45_sector_pages();
+        uint32_t    n;
+
+        // scratch area: whole sectors at the end of the array
+        _pages = _flash.at45_page_count() / 2;
+        if (_pages > AT45_BENCH_PAGES) {
+            _pages = AT45_BENCH_PAGES;
+        }
+        _pages -= _pages % sec_pages;
+        if (_pages == 0) {
+            _pages = sec_pages;
+        }
+        _first = _flash.at45_page_count() - _pages;
+        n = AT45DBBench::limit(_pages);
+
+        printf("%-22s %6s %10s %10s %10s %10s %10s %6s\n", 
+               "scenario", "ops", "MB/s", "ops/s", "p50 us", "p99 us", "p999 us", "errors");
+        _flash.at45_wait_ready(AT45_WAIT_DEFAULT);
+        _flash.at45_erase_range(AT45DBBench::page(0), _pages * _flash.at45_page_size());
+
+        AT45DBBench::write_pages("writepage no erase", n, AT45DBTypes::AT45_OP_PROGRAM);
+        AT45DBBench::write_pages("writepage with erase", n, AT45DBTypes::AT45_OP_ERASE_PROGRAM);
+        AT45DBBench::read_pages("read page sequential", n, false);
+        AT45DBBench::read_pages("read page random", n, true);
+        AT45DBBench::read_stream("read continuous x8", AT45DBBench::limit(_pages / 8));
+        AT45DBBench::buffer_writes("buffer write", AT45DBBench::limit(AT45_BENCH_OPS));
+        AT45DBBench::erase("erase page", n, 1, AT45DBTypes::AT45_OP_PAGE_ERASE);
+        AT45DBBench::erase("erase block", AT45DBBench::limit(_pages / blk_pages), blk_pages, 
+                           AT45DBTypes::AT45_OP_BLOCK_ERASE);
+        AT45DBBench::erase("erase sector", _pages / sec_pages, sec_pages, AT45DBTypes::AT45_OP_SECTOR_ERASE);
+#if AT45_BENCH_CHIP_ERASE
+        AT45DBBench::erase("erase chip", 1, _flash.at45_page_count(), AT45DBTypes::AT45_OP_CHIP_ERASE);
+#endif  // AT45_BENCH_CHIP_ERASE
+        AT45DBBench::power_cycles("ultra deep pd + wake", AT45DBBench::limit(AT45_BENCH_OPS));
+    }
+
+    /*
+     * Whole page writes over the scratch area, each waited to completion.
+     * Over erased pages (first pass) the driver programs without erase;
+     * 'op' paces the ready polling to match.
+     */
+    void write_pages(const char *name, uint32_t n, AT45DBTypes::OPERATIONS op)
+    {
+        uint32_t    size = _flash.at45_page_size();
+        uint32_t    i, j;
+        uint64_t    t0;
+
+        AT45DBBench::begin();
+        for (i=0; i<n; i++) {
+            for (j=0; j<size; j++) {
+                _data[j] = (uint8_t)(i + j);
+            }
+            t0 = _clock.now_ns();
+            if (!_flash.at45_writepage(AT45DBBench::page(i), _data, size) ||
+                    (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, op) != AT45DBTypes::AT45_OK)) {
+                _errors++;
+            }
+            AT45DBBench::sample(t0);
+        }
+        AT45DBBench::report(name, _flash.at45_page_size());
+    }
+
+    /*
+     * Single page reads, in order or at random within the scratch area
+     */
+    void read_pages(const char *name, uint32_t n, bool random)
+    {
+        uint32_t    i, p;
+        uint64_t    t0;
+
+        AT45DBBench::begin();
+        for (i=0; i<n; i++) {
+            p = random ? (AT45DBBench::next_random() % _pages) : (i % _pages);
+            t0 = _clock.now_ns();
+            if (!_flash.at45_readpage(AT45DBBench::page(p), _data, _flash.at45_page_size())) {
+                _errors++;
+            }
+            AT45DBBench::sample(t0);
+        }
+        AT45DBBench::report(name, _flash.at45_page_size());
+    }
+
+    /*
+     * Continuous array reads of 8 pages in one command
+     */
+    void read_stream(const char *name, uint32_t n)
+    {
+        uint32_t    i;
+        uint64_t    t0;
+
+        AT45DBBench::begin();
+        for (i=0; i<n; i++) {
+            t0 = _clock.now_ns();
+            if (!_flash.at45_read(AT45DBBench::page((i * 8) % _pages), _stream, 8 * _flash.at45_page_size())) {
+                _errors++;
+            }
+            AT45DBBench::sample(t0);
+        }
+        AT45DBBench::report(name, 8 * _flash.at45_page_size());
+    }
+
+    /*
+     * Whole page loads into SRAM buffer 1, no programming
+     */
+    void buffer_writes(const char *name, uint32_t n)
+    {
+        uint32_t    i;
+        uint64_t    t0;
+
+        AT45DBBench::begin();
+        for (i=0; i<n; i++) {
+            t0 = _clock.now_ns();
+            if (!_flash.at45_buffer_write(AT45DBTypes::AT45_BUFFER1, 0, _data, _flash.at45_page_size())) {
+                _errors++;
+            }
+            AT45DBBench::sample(t0);
+        }
+        AT45DBBench::report(name, _flash.at45_page_size());
+    }
+
+    /*
+     * Erases of 'pages' pages each, walking through the scratch area
+     * (or the whole chip), each waited to completion
+     */
+    void erase(const char *name, uint32_t n, uint32_t pages, AT45DBTypes::OPERATIONS op)
+    {
+        uint32_t    i, addr;
+        uint64_t    t0;
+        bool        ok;
+
+        AT45DBBench::begin();
+        for (i=0; i<n; i++) {
+            addr = AT45DBBench::page((i * pages) % _pages);
+            t0 = _clock.now_ns();
+            switch (op) {
+            case AT45DBTypes::AT45_OP_BLOCK_ERASE:
+                ok = _flash.at45_eraseblock(addr);
+                break;
+            case AT45DBTypes::AT45_OP_SECTOR_ERASE:
+                ok = _flash.at45_erasesector(addr);
+                break;
+            case AT45DBTypes::AT45_OP_CHIP_ERASE:
+                ok = _flash.at45_erasechip();
+                break;
+            default:
+                ok = _flash.at45_erasepage(addr);
+                break;
+            }
+            if (!ok || (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, op) != AT45DBTypes::AT45_OK)) {
+                _errors++;
+            }
+            AT45DBBench::sample(t0);
+        }
+        AT45DBBench::report(name, pages * _flash.at45_page_size());
+    }
+
+    /*
+     * Ultra deep power down and wake, checking the ID after each wake
+     */
+    void power_cycles(const char *name, uint32_t n)
+    {
+        uint32_t    i;
+        uint64_t    t0;
+
+        AT45DBBench::begin();
+        for (i=0; i<n; i++) {
+            t0 = _clock.now_ns();
+            _flash.at45_ultra_deep_pwrdown_enter();
+            _flash.at45_ultra_deep_pwrdown_exit();
+            AT45DBBench::sample(t0);
+            if (_flash.at45_get_id() != _flash.at45_device_info().id) {
+                _errors++;
+            }
+        }
+        AT45DBBench::report(name, 0);
+    }
+
+private:
+
+    AT45DBCore<Bus>     &_flash;
+    Clock               &_clock;
+    uint32_t            _samples[AT45_BENCH_OPS];   // latency of each operation, us
+    uint32_t            _count;
+    uint32_t            _errors;
+    uint64_t            _total_ns;
+    uint32_t            _seed;
+    uint32_t            _first;                     // scratch area, first page
+    uint32_t            _pages;                     // scratch area, pages
+    uint8_t             _data[AT45_PAGE_SIZE];
+    uint8_t             _stream[8 * AT45_PAGE_SIZE];
+
+    static uint32_t limit(uint32_t n)
+    {
+        return (n < AT45_BENCH_OPS) ? n : AT45_BENCH_OPS;
+    }
+
+    uint32_t page(uint32_t i)
+    {
+        return (_first + i) * _flash.at45_page_size();
+    }
+
+    uint32_t next_random(void)
+    {
+        _seed = (_seed * 1103515245) + 12345;
+        return _seed >> 16;
+    }
+
+    void begin(void)
+    {
+        _count = 0;
+        _errors = 0;
+        _total_ns = 0;
+    }
+
+    void sample(uint64_t t0)
+    {
+        uint64_t    dt = _clock.now_ns() - t0;
+
+        _total_ns += dt;
+        if (_count < AT45_BENCH_OPS) {
+            _samples[_count++] = (uint32_t)(dt / 1000);
+        }
+    }
+
+    static int compare(const void *a, const void *b)
+    {
+        uint32_t    x = *(const uint32_t *)a;
+        uint32_t    y = *(const uint32_t *)b;
+
+        return (x < y) ? -1 : ((x > y) ? 1 : 0);
+    }
+
+    /*
+     * Nearest rank percentile, 'permille' of the sorted samples
+     */
+    uint32_t percentile(uint32_t permille)
+    {
+        uint32_t    rank = ((_count * permille) + 999) / 1000;
+
+        return _samples[(rank > 0) ? rank - 1 : 0];
+    }
+
+    /*
+     * Throughput from the summed operation times: bytes per us is MB/s
+     */
+    void report(const char *name, uint32_t bytes_per_op)
+    {
+        uint64_t    us = (_total_ns + 500) / 1000;
+        uint64_t    mbps_milli = 0;
+        uint64_t    ops_tenths = 0;
+
+        if (_count == 0) {
+            return;
+        }
+        if (us > 0) {
+            mbps_milli = ((uint64_t)bytes_per_op * _count * 1000) / us;
+            ops_tenths = ((uint64_t)_count * 10000000) / us;
+        }
+        qsort(_samples, _count, sizeof(_samples[0]), AT45DBBench::compare);
+        printf("%-22s %6lu %6lu.%03lu %8lu.%01lu %10lu %10lu %10lu %6lu\n", name, (unsigned long)_count,
+               (unsigned long)(mbps_milli / 1000), (unsigned long)(mbps_milli % 1000),
+               (unsigned long)(ops_tenths / 10), (unsigned long)(ops_tenths % 10),
+               (unsigned long)AT45DBBench::percentile(500), (unsigned long)AT45DBBench::percentile(990),
+               (unsigned long)AT45DBBench::percentile(999), (unsigned long)_errors);
+    }
+
+};
+
+#endif // _AT45DBBENCH_H_
@@ -0,0 +1,152 @@
+/* 
+ * @file    AT45DBBlockDevice.cpp
+ * @brief   mbed BlockDevice adapter for the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBBlockDevice.h"
+
+AT45DBBlockDevice::AT45DBBlockDevice(AT45DB &flash) :
+        _flash(flash), _buffer(AT45DB::AT45_BUFFER1), _busy(false)
+{
+}
+
+AT45DBBlockDevice::~AT45DBBlockDevice() { }
+
+int AT45DBBlockDevice::init()
+{
+    if (_flash.at45_get_id() != _flash.at45_device_info().id) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    return BD_ERROR_OK;
+}
+
+int AT45DBBlockDevice::deinit()
+{
+    return AT45DBBlockDevice::sync();
+}
+
+int AT45DBBlockDevice::sync()
+{
+    return AT45DBBlockDevice::wait_programmed();
+}
+
+int AT45DBBlockDevice::read(void *buffer, bd_addr_t addr, bd_size_t size)
+{
+    if (!is_valid_read(addr, size)) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    if (AT45DBBlockDevice::wait_programmed() != BD_ERROR_OK) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    if (!_flash.at45_read((uint32_t)addr, (uint8_t *)buffer, (uint32_t)size)) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    return BD_ERROR_OK;
+}
+
+/*
+ * The next page is written into the idle buffer while the device is 
+ * still programming the previous one; only the program command waits.
+ * The last page is left programming until the next call needs the 
+ * device, or sync().
+ */
+int AT45DBBlockDevice::program(const void *buffer, bd_addr_t addr, bd_size_t size)
+{
+    const uint8_t   *data = (const uint8_t *)buffer;
+    uint32_t        page = _flash.at45_page_size();
+
+    if (!is_valid_program(addr, size)) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    while (size > 0) {
+        _flash.at45_buffer_write(_buffer, 0, data, page);
+        if (AT45DBBlockDevice::wait_programmed() != BD_ERROR_OK) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+        _flash.at45_buffer_program(_buffer, (uint32_t)addr, false);
+        _busy = true;
+        _buffer = (_buffer == AT45DB::AT45_BUFFER1) ? AT45DB::AT45_BUFFER2 : AT45DB::AT45_BUFFER1;
+        data += page;
+        addr += page;
+        size -= page;
+    }
+    return BD_ERROR_OK;
+}
+
+int AT45DBBlockDevice::erase(bd_addr_t addr, bd_size_t size)
+{
+    if (!is_valid_erase(addr, size)) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    if (AT45DBBlockDevice::wait_programmed() != BD_ERROR_OK) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    if (_flash.at45_erase_range((uint32_t)addr, (uint32_t)size) != AT45DB::AT45_OK) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    return BD_ERROR_OK;
+}
+
+bd_size_t AT45DBBlockDevice::get_read_size() const
+{
+    return 1;
+}
+
+bd_size_t AT45DBBlockDevice::get_program_size() const
+{
+    return _flash.at45_page_size();
+}
+
+bd_size_t AT45DBBlockDevice::get_erase_size() const
+{
+    return _flash.at45_block_pages() * _flash.at45_page_size();
+}
+
+bd_size_t AT45DBBlockDevice::get_erase_size(bd_addr_t addr) const
+{
+    // blocks are the same size throughout
+    (void)addr;
+    return AT45DBBlockDevice::get_erase_size();
+}
+
+int AT45DBBlockDevice::get_erase_value() const
+{
+    return 0xff;
+}
+
+bd_size_t AT45DBBlockDevice::size() const
+{
+    return (bd_size_t)_flash.at45_page_count() * _flash.at45_page_size();
+}
+
+const char *AT45DBBlockDevice::get_type() const
+{
+    return "AT45DB";
+}
+
+int AT45DBBlockDevice::wait_programmed(void)
+{
+    if (_busy) {
+        _busy = false;
+        if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_PROGRAM) != AT45DB::AT45_OK) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+    }
+    return BD_ERROR_OK;
+}
@@ -0,0 +1,117 @@
+/* 
+ * @file    AT45DBBlockDevice.h
+ * @brief   mbed BlockDevice adapter for the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBBLOCKDEVICE_H_
+#define _AT45DBBLOCKDEVICE_H_
+
+#include "AT45DB.h"
+#include "BlockDevice.h"
+
+/**
+ * mbed BlockDevice on an AT45DB, for LittleFS and the other mbed 
+ * filesystems
+ *
+ * Reads map onto a single continuous array read, so the read size is 
+ * one byte. Programs are whole pages written through alternate SRAM 
+ * buffers and programmed without erase (the filesystem only programs
+ * erased space), with the next page clocked in while the previous one
+ * programs. Erases are whole blocks, or sectors where the range covers
+ * them, so the filesystem never pays for the built-in page erase of a
+ * write-with-erase.
+ */
+class AT45DBBlockDevice : public BlockDevice
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device to expose
+     */
+    AT45DBBlockDevice(AT45DB &flash);
+
+    virtual ~AT45DBBlockDevice();
+
+    /*
+     * Check the device answers with the expected ID
+     *
+     * @return BD_ERROR_OK or BD_ERROR_DEVICE_ERROR
+     */
+    virtual int init();
+
+    virtual int deinit();
+
+    /*
+     * Wait for any page program still in progress
+     *
+     * @return BD_ERROR_OK or BD_ERROR_DEVICE_ERROR
+     */
+    virtual int sync();
+
+    /*
+     * @param *buffer = pointer to destination memory buffer
+     * @param addr = address in flash from which to start reading
+     * @param size = number of bytes to read
+     * @return BD_ERROR_OK or BD_ERROR_DEVICE_ERROR
+     */
+    virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+
+    /*
+     * Program whole pages of erased flash, without erase
+     *
+     * @param *buffer = pointer to source in CPU memory space
+     * @param addr = page aligned address of the first page
+     * @param size = multiple of the page size
+     * @return BD_ERROR_OK or BD_ERROR_DEVICE_ERROR
+     */
+    virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+
+    /*
+     * Erase whole blocks, using sector erases where the range covers 
+     * complete sectors
+     *
+     * @param addr = block aligned address
+     * @param size = multiple of the block size
+     * @return BD_ERROR_OK or BD_ERROR_DEVICE_ERROR
+     */
+    virtual int erase(bd_addr_t addr, bd_size_t size);
+
+    virtual bd_size_t get_read_size() const;
+    virtual bd_size_t get_program_size() const;
+    virtual bd_size_t get_erase_size() const;
+    virtual bd_size_t get_erase_size(bd_addr_t addr) const;
+    virtual int get_erase_value() const;
+    virtual bd_size_t size() const;
+    virtual const char *get_type() const;
+
+private:
+
+    AT45DB              &_flash;
+    AT45DB::BUFFERS     _buffer;        // buffer for the next page
+    bool                _busy;          // a page program may be in progress
+
+    /*
+     * Wait for the previous page program to finish
+     */
+    int wait_programmed(void);
+
+};
+
+#endif // _AT45DBBLOCKDEVICE_H_
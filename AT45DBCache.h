@@ -0,0 +1,272 @@
+/* 
+ * @file    AT45DBCache.h
+ * @brief   Adesto AT45DB RAM page cache with write-back
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBCACHE_H_
+#define _AT45DBCACHE_H_
+
+#include "AT45DB.h"
+
+/**
+ * N-page LRU cache with write-back in front of an AT45DB
+ *
+ * Reads of a cached page are served from RAM. Writes update the cached 
+ * copy and mark it dirty; dirty pages are programmed when evicted or 
+ * when flush() is called. The slots are part of the object, so the cache
+ * uses no heap: an AT45DBCache<4> costs a little over 2KB of RAM.
+ *
+ * All access to the cached range should go through the cache; the 
+ * device is waited ready before each page is read or programmed.
+ */
+template <int N>
+class AT45DBCache
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device to cache
+     */
+    AT45DBCache(AT45DB &flash) : _flash(flash), _clock(0), _hits(0), _misses(0), _pending(-1)
+    {
+        AT45DBCache::invalidate();
+    }
+
+    ~AT45DBCache() { }
+
+    /*
+     * Read data through the cache, loading missing pages into the 
+     * least recently used slot.
+     *
+     * @param addr = address in flash from which to start reading
+     * @param *buff = pointer to destination memory buffer
+     * @param size = number of bytes to read
+     * @return true = success
+     */
+    bool read(uint32_t addr, uint8_t *buff, uint32_t size)
+    {
+        uint32_t    offset, n;
+        int         i;
+
+        while (size > 0) {
+            offset = addr % _flash.at45_page_size();
+            n = _flash.at45_page_size() - offset;
+            if (n > size) {
+                n = size;
+            }
+            i = AT45DBCache::lookup(addr - offset, true);
+            if (i < 0) {
+                return 0;
+            }
+            memcpy(buff, &_slot[i].data[offset], n);
+            addr += n;
+            buff += n;
+            size -= n;
+        }
+        return 1;
+    }
+
+    /*
+     * Write data into the cache. The pages are programmed later, when 
+     * evicted or flushed. A write covering a whole page does not read it.
+     *
+     * @param addr = address in flash from which to start writing
+     * @param *buff = pointer to source in CPU memory space
+     * @param size = number of bytes to write
+     * @return true = success
+     */
+    bool write(uint32_t addr, const uint8_t *buff, uint32_t size)
+    {
+        uint32_t    offset, n;
+        int         i;
+
+        while (size > 0) {
+            offset = addr % _flash.at45_page_size();
+            n = _flash.at45_page_size() - offset;
+            if (n > size) {
+                n = size;
+            }
+            i = AT45DBCache::lookup(addr - offset, n < _flash.at45_page_size());
+            if (i < 0) {
+                return 0;
+            }
+            memcpy(&_slot[i].data[offset], buff, n);
+            _slot[i].dirty = true;
+            addr += n;
+            buff += n;
+            size -= n;
+        }
+        return 1;
+    }
+
+    /*
+     * Program all dirty pages into flash and wait for the last one. A 
+     * page that fails to program stays dirty, for the next flush().
+     *
+     * @return true = all pages programmed without error
+     */
+    bool flush(void)
+    {
+        bool    ok = true;
+        int     i;
+
+        for (i=0; i<N; i++) {
+            if (!AT45DBCache::writeback(i)) {
+                ok = false;
+            }
+        }
+        if (!AT45DBCache::settle()) {
+            ok = false;
+        }
+        return ok;
+    }
+
+    /*
+     * Drop all cached pages, including unflushed writes
+     */
+    void invalidate(void)
+    {
+        int     i;
+
+        for (i=0; i<N; i++) {
+            _slot[i].valid = false;
+            _slot[i].dirty = false;
+        }
+        _pending = -1;
+    }
+
+    /*
+     * @return number of page accesses served from RAM
+     */
+    uint32_t hits(void)
+    {
+        return _hits;
+    }
+
+    /*
+     * @return number of page accesses that had to load or allocate a slot
+     */
+    uint32_t misses(void)
+    {
+        return _misses;
+    }
+
+private:
+
+    struct slot {
+        uint32_t    page;                       // page address in flash
+        uint32_t    used;                       // LRU stamp
+        bool        valid;
+        bool        dirty;
+        uint8_t     data[AT45_PAGE_SIZE];
+    };
+
+    AT45DB          &_flash;
+    uint32_t        _clock;
+    uint32_t        _hits;
+    uint32_t        _misses;
+    int             _pending;                   // slot whose program is not yet confirmed, or -1
+    struct slot     _slot[N];
+
+    /*
+     * Find the slot holding 'page', or evict the least recently used
+     * slot and (if 'load') read the page into it.
+     */
+    int lookup(uint32_t page, bool load)
+    {
+        int     i;
+        int     victim = 0;
+
+        for (i=0; i<N; i++) {
+            if (_slot[i].valid && (_slot[i].page == page)) {
+                _slot[i].used = ++_clock;
+                _hits++;
+                return i;
+            }
+            if (!_slot[i].valid) {
+                victim = i;
+            } else if (_slot[victim].valid && (_slot[i].used < _slot[victim].used)) {
+                victim = i;
+            }
+        }
+        _misses++;
+        if (!AT45DBCache::writeback(victim)) {
+            return -1;
+        }
+        // the victim's data is kept until its program is known to be good
+        if (load || (_pending == victim)) {
+            if (!AT45DBCache::settle()) {
+                return -1;
+            }
+        }
+        if (load) {
+            _flash.at45_read(page, _slot[victim].data, _flash.at45_page_size());
+        }
+        _slot[victim].page = page;
+        _slot[victim].used = ++_clock;
+        _slot[victim].valid = true;
+        _slot[victim].dirty = false;
+        return victim;
+    }
+
+    /*
+     * Program a dirty slot into flash. The program is checked by the 
+     * next settle(); a slot that fails stays (or becomes) dirty again.
+     */
+    bool writeback(int i)
+    {
+        if (_slot[i].valid && _slot[i].dirty) {
+            if (!AT45DBCache::settle()) {
+                return 0;
+            }
+            if (!_flash.at45_writepage(_slot[i].page, _slot[i].data, _flash.at45_page_size())) {
+                return 0;
+            }
+            _slot[i].dirty = false;
+            _pending = i;
+        }
+        return 1;
+    }
+
+    /*
+     * Wait for the last program. On an erase/program failure or a 
+     * timeout the slot it came from is marked dirty again. The EP bit 
+     * stays set until the next erase or program, so with no program of 
+     * ours outstanding it is old news and only a timeout fails.
+     */
+    bool settle(void)
+    {
+        int     i = _pending;
+        int     result;
+
+        _pending = -1;
+        result = _flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM);
+        if ((result == AT45DB::AT45_OK) || ((result == AT45DB::AT45_ERR_EP) && (i < 0))) {
+            return 1;
+        }
+        if (i >= 0) {
+            _slot[i].dirty = true;
+        }
+        return 0;
+    }
+
+};
+
+#endif // _AT45DBCACHE_H_
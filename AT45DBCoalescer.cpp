@@ -0,0 +1,167 @@
+/* 
+ * @file    AT45DBCoalescer.cpp
+ * @brief   Adesto AT45DB small-write coalescing into the SRAM buffers
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBCoalescer.h"
+
+AT45DBCoalescer::AT45DBCoalescer(AT45DB &flash, uint32_t deadline_ms) :
+        _flash(flash), _deadline_ms(deadline_ms), _start_us(0), _page(0), _offset(0), 
+        _padded(flash.at45_page_size()), _buffer(AT45DB::AT45_BUFFER1), _pending(false),
+        _page_programs(0), _busy(false), _busy_active(false), _programs(0)
+{
+}
+
+AT45DBCoalescer::~AT45DBCoalescer() { }
+
+void AT45DBCoalescer::begin(uint32_t addr)
+{
+    _page = addr - (addr % _flash.at45_page_size());
+    _offset = 0;
+    _padded = _flash.at45_page_size();
+    _pending = false;
+    _page_programs = 0;
+}
+
+bool AT45DBCoalescer::append(const uint8_t *rec, uint32_t len)
+{
+    uint32_t    n;
+
+    while (len > 0) {
+        // the active buffer cannot be written while it is being programmed
+        if (_busy_active && !AT45DBCoalescer::wait()) {
+            return 0;
+        }
+        n = _flash.at45_page_size() - _offset;
+        if (n > len) {
+            n = len;
+        }
+        _flash.at45_buffer_write(_buffer, _offset, rec, n);
+        _offset += n;
+        if (_padded < _offset) {
+            _padded = _offset;
+        }
+        rec += n;
+        len -= n;
+        if (!_pending) {
+            _pending = true;
+            _start_us = _flash.at45_now_us();
+        }
+        if ((_offset == _flash.at45_page_size()) && !AT45DBCoalescer::commit()) {
+            return 0;
+        }
+    }
+    return AT45DBCoalescer::poll();
+}
+
+bool AT45DBCoalescer::poll(void)
+{
+    if (_pending && ((uint32_t)(_flash.at45_now_us() - _start_us) >= _deadline_ms * 1000)) {
+        return AT45DBCoalescer::commit();
+    }
+    return 1;
+}
+
+bool AT45DBCoalescer::flush(void)
+{
+    if (_pending && !AT45DBCoalescer::commit()) {
+        return 0;
+    }
+    return AT45DBCoalescer::wait();
+}
+
+uint32_t AT45DBCoalescer::address(void)
+{
+    return _page + _offset;
+}
+
+uint32_t AT45DBCoalescer::programs(void)
+{
+    return _programs;
+}
+
+/*
+ * Program the active buffer into the current page. A partial page is 
+ * padded with FFh once, so the tail programs as erased. The first
+ * program of a page skips the erase if the page is already erased. A
+ * page programmed before by the deadline is programmed again without
+ * an erase (88h/89h): the bytes already in flash are sent unchanged
+ * and the FFh tail leaves the rest erased. Only after 
+ * AT45_PARTIAL_PROGRAMS such programs is the page erased again.
+ */
+bool AT45DBCoalescer::commit(void)
+{
+    uint8_t     pad[16];
+    uint32_t    start, n;
+    bool        erase;
+
+    if (_padded > _offset) {
+        if (_busy_active && !AT45DBCoalescer::wait()) {
+            return 0;
+        }
+        memset(pad, 0xff, sizeof(pad));
+        for (start=_offset; start<_padded; start+=n) {
+            n = _padded - start;
+            if (n > sizeof(pad)) {
+                n = sizeof(pad);
+            }
+            _flash.at45_buffer_write(_buffer, start, pad, n);
+        }
+        _padded = _offset;
+    }
+
+    if (!AT45DBCoalescer::wait()) {
+        return 0;
+    }
+    if (_page_programs == 0) {
+        erase = !_flash.at45_is_page_erased(_page);
+    } else {
+        erase = (_page_programs >= AT45_PARTIAL_PROGRAMS);
+    }
+    _page_programs = erase ? 1 : _page_programs + 1;
+    _flash.at45_buffer_program(_buffer, _page, erase);
+    _programs++;
+    _busy = true;
+    _pending = false;
+
+    if (_offset == _flash.at45_page_size()) {
+        // page complete: carry on in the other buffer while this one programs
+        _page += _flash.at45_page_size();
+        _offset = 0;
+        _padded = _flash.at45_page_size();
+        _page_programs = 0;
+        _busy_active = false;
+        _buffer = (_buffer == AT45DB::AT45_BUFFER1) ? AT45DB::AT45_BUFFER2 : AT45DB::AT45_BUFFER1;
+    } else {
+        _busy_active = true;
+    }
+    return 1;
+}
+
+bool AT45DBCoalescer::wait(void)
+{
+    if (_busy) {
+        _busy = false;
+        _busy_active = false;
+        if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) != AT45DB::AT45_OK) {
+            return 0;
+        }
+    }
+    return 1;
+}
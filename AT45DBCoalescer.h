@@ -0,0 +1,131 @@
+/* 
+ * @file    AT45DBCoalescer.h
+ * @brief   Adesto AT45DB small-write coalescing into the SRAM buffers
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBCOALESCER_H_
+#define _AT45DBCOALESCER_H_
+
+#include "AT45DB.h"
+
+#ifndef AT45_PARTIAL_PROGRAMS
+#define AT45_PARTIAL_PROGRAMS   16              // programs of a page without an erase, before it is erased again
+#endif  // AT45_PARTIAL_PROGRAMS
+
+/**
+ * Coalescing writer for small records
+ *
+ * Records are appended into the active SRAM buffer at increasing 
+ * offsets with partial buffer writes; nothing is programmed until the
+ * page is full or the oldest uncommitted record is older than the flush
+ * deadline. A page of 16-byte records then costs one page program
+ * instead of 32.
+ *
+ * A page committed early by the deadline stays in its buffer: later
+ * records are appended behind it and the page is programmed again, 
+ * without an erase, when it fills or the deadline expires again. When a
+ * page is full the other buffer becomes active, so appending continues
+ * while it programs.
+ *
+ * The deadline is only checked in append() and poll(); call poll()
+ * periodically when records may stop arriving. It is timed with the
+ * bus clock (AT45DB::at45_now_us()).
+ *
+ * Both SRAM buffers belong to the coalescer from begin() until flush()
+ * returns: the uncommitted records, and the image of a page committed
+ * early that the next program without erase sends again, are only held
+ * there. Other driver calls that use the buffers (at45_writepage, 
+ * at45_update, at45_page2buffer, buffer writes and compares) must wait
+ * until then, or the page is programmed with their data.
+ */
+class AT45DBCoalescer
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device to write to
+     * @param deadline_ms = longest time a record may stay uncommitted
+     */
+    AT45DBCoalescer(AT45DB &flash, uint32_t deadline_ms);
+
+    ~AT45DBCoalescer();
+
+    /*
+     * Start appending at a page. Anything still uncommitted should be
+     * flushed first.
+     *
+     * @param addr = address of the first page to write (page aligned)
+     */
+    void begin(uint32_t addr);
+
+    /*
+     * Append a record. Records may span a page boundary.
+     *
+     * @param *rec = pointer to source in CPU memory space
+     * @param len = number of bytes to append
+     * @return false if a program failed or the device did not become ready
+     */
+    bool append(const uint8_t *rec, uint32_t len);
+
+    /*
+     * Commit the current page if the flush deadline has expired
+     *
+     * @return false if a program failed or the device did not become ready
+     */
+    bool poll(void);
+
+    /*
+     * Commit the current page now and wait for it to be programmed
+     *
+     * @return false if a program failed or the device did not become ready
+     */
+    bool flush(void);
+
+    /*
+     * @return address in flash at which the next record will be written
+     */
+    uint32_t address(void);
+
+    /*
+     * @return number of page programs issued
+     */
+    uint32_t programs(void);
+
+private:
+
+    AT45DB              &_flash;
+    uint32_t            _deadline_ms;
+    uint32_t            _start_us;          // when the oldest uncommitted record was appended
+    uint32_t            _page;              // page being filled
+    uint32_t            _offset;            // fill level of the active buffer
+    uint32_t            _padded;            // offset from which the buffer is known to be FFh
+    AT45DB::BUFFERS     _buffer;            // active buffer
+    bool                _pending;           // records not yet committed
+    uint32_t            _page_programs;     // programs of the page since it was erased
+    bool                _busy;              // a page program may be in progress
+    bool                _busy_active;       // ... from the active buffer
+    uint32_t            _programs;
+
+    bool commit(void);
+    bool wait(void);
+
+};
+
+#endif // _AT45DBCOALESCER_H_
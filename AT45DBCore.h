@@ -0,0 +1,982 @@
+/* 
+ * @file    AT45DBCore.h
+ * @brief   Device driver - Adesto AT45DB serial flash driver core, templated over the SPI bus
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+ 
+/*
+ * This driver library does not implement all available chip functions.
+ * Specifically missing are:
+ *      software reset
+ *      sector protection, lockdown and security
+ *      freeze sector, and OTP programming
+ */
+ 
+#ifndef _AT45DBCORE_H_
+#define _AT45DBCORE_H_
+ 
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <utility>
+
+// on mbed builds AT45DB.h includes mbed.h first, so MBED_VERSION is known here
+#if defined(MBED_VERSION) && defined(MBED_ENCODE_VERSION)
+#if MBED_VERSION >= MBED_ENCODE_VERSION(5, 12, 0)
+#define AT45_HAS_SPAN       1                   // mbed::Span is available
+#include "platform/Span.h"
+#endif
+#endif
+#ifndef AT45_HAS_SPAN
+#define AT45_HAS_SPAN       0
+#endif
+ 
+/**
+ * Adesto Serial Flash Low Power Memories
+ * AT45DB Series SPI-Flash Memory - AT45DB161E, 16Mbit as basis
+ */
+#define AT45_CS_LOW         0                   // SPI CS# (Chip Select) Setting 
+#define AT45_CS_HIGH        1                   // SPI CS# (Chip Select) Setting 
+#define DUMMY               0x00                // Dummy byte which can be changed to any value
+#define AT45_CHIP_ERASE     0x94, 0x80, 0x9A    // extended erase command bytes
+#define AT45_BINARY_PAGE    0x2A, 0x80, 0xA6    // extended binary page command bytes
+
+#ifndef MAX_SPI_CLK
+#define MAX_SPI_CLK         8000000
+#endif  // MAX_SPI_CLK
+#define AT45_SPI_FREQ       (((MAX_SPI_CLK) < (16000000)) ? (MAX_SPI_CLK) : (16000000))         // SPI frequency
+
+#define AT45DB011D_ID       0x1F2200            // at45_get_id() of each part in at45_devices
+#define AT45DB021E_ID       0x1F2300
+#define AT45DB041E_ID       0x1F2400
+#define AT45DB081E_ID       0x1F2500
+#define AT45DB161E_ID       0x1F2600
+#define AT45DB321E_ID       0x1F2701
+#define AT45DB641E_ID       0x1F2800
+
+#ifndef AT45_DEVICE
+#define AT45_DEVICE         AT45DB161E_ID       // part fitted, or 0 for any part in at45_devices
+#endif  // AT45_DEVICE
+
+#define AT45_CAP_READ_LP    0x01                // 01h low power continuous read
+#define AT45_CAP_UDPD       0x02                // 79h ultra deep power down
+#define AT45_CAP_STATUS2    0x04                // status register byte 2 (EP error bit)
+#define AT45_CAP_E          (AT45_CAP_READ_LP | AT45_CAP_UDPD | AT45_CAP_STATUS2)   // all of the E series
+
+/**
+ * Geometry and features of one AT45DB part, binary (power of 2) page size.
+ * Sector 0 is split: 0a is the first block, 0b the rest of the sector.
+ */
+struct at45_device {
+    uint32_t    id;                             // at45_get_id(): manufacturer, family and density, device code
+    uint32_t    page_size;                      // bytes per page (and per SRAM buffer)
+    uint32_t    block_pages;                    // pages per block erase
+    uint32_t    page_count;
+    uint32_t    sector_pages;                   // pages per sector erase
+    uint32_t    max_clock;                      // highest SPI clock (continuous read 0Bh)
+    uint32_t    caps;                           // AT45_CAP_* features
+};
+
+constexpr at45_device at45_devices[] = {
+    { AT45DB011D_ID, 256, 8,   512,  128, 66000000, 0 },
+    { AT45DB021E_ID, 256, 8,  1024,  128, 70000000, AT45_CAP_E },
+    { AT45DB041E_ID, 256, 8,  2048,  256, 85000000, AT45_CAP_E },
+    { AT45DB081E_ID, 256, 8,  4096,  256, 85000000, AT45_CAP_E },
+    { AT45DB161E_ID, 512, 8,  4096,  256, 85000000, AT45_CAP_E },
+    { AT45DB321E_ID, 512, 8,  8192,  128, 85000000, AT45_CAP_E },
+    { AT45DB641E_ID, 256, 8, 32768, 1024, 85000000, AT45_CAP_E },
+};
+
+/*
+ * Look up a part by ID: index in at45_devices or -1, entry or NULL
+ */
+constexpr int at45_device_index(uint32_t id, uint32_t i = 0)
+{
+    return (i >= sizeof(at45_devices) / sizeof(at45_devices[0])) ? -1 :
+           (at45_devices[i].id == id) ? (int)i : at45_device_index(id, i + 1);
+}
+
+constexpr const at45_device *at45_find_device(uint32_t id)
+{
+    return (at45_device_index(id) < 0) ? NULL : &at45_devices[at45_device_index(id)];
+}
+
+#if AT45_DEVICE
+/*
+ * Fixed part: the geometry is a compile time constant, buffers are 
+ * sized for it and the driver's address arithmetic folds to shifts 
+ * and masks.
+ */
+static_assert(at45_device_index(AT45_DEVICE) >= 0, "AT45_DEVICE is not in at45_devices");
+constexpr const at45_device *at45_fixed_device = &at45_devices[at45_device_index(AT45_DEVICE)];
+
+#define AT45_PAGE_SIZE      (at45_fixed_device->page_size)
+#define AT45_PAGE_COUNT     (at45_fixed_device->page_count)
+#else
+/*
+ * Any part, found at init: buffers are sized for the largest page and
+ * page count in the table, and the geometry is read from the entry 
+ * found (at45_page_size() etc.). AT45_PAGE_SIZE and AT45_PAGE_COUNT are
+ * then only upper bounds, for sizing buffers.
+ */
+#define AT45_PAGE_SIZE      512
+#define AT45_PAGE_COUNT     32768
+#endif  // AT45_DEVICE
+
+#ifndef AT45_TRACK_ERASED
+#define AT45_TRACK_ERASED   1                   // keep a RAM map of pages known to be erased
+#endif  // AT45_TRACK_ERASED
+
+#ifndef AT45_STATS
+#define AT45_STATS          1                   // count commands, bytes and wait time (at45_get_stats, ~1KB RAM)
+#endif  // AT45_STATS
+
+#define AT45_NO_PAGE        0xFFFFFFFF          // SRAM buffer does not hold a copy of any page
+#define AT45_WAIT_DEFAULT   0                   // wait timeout: twice the datasheet maximum for the operation
+
+/* 
+ * status is 16-bit value with status byte1 in the 
+ * upper byte and byte2 in the lower byte. 
+ */
+/// Returns 0x80 if the device is ready; otherwise 0.
+#define AT45_STATUS_READY(status)       (((status) >> 8) & 0x80)
+/// Returns the device ID code.
+#define AT45_STATUS_ID(status)          (((status) >> 8) & 0x3c)
+/// Returns 1 if the device is configured in binary page mode; otherwise 0.
+#define AT45_STATUS_BINARY(status)      (((status) >> 8) & 0x01)
+/// Returns 1 if erase or program operation failed; otherwise 0.
+#define AT45_STATUS_EP_ERROR(status)    (((status) & 0xff) & 0x20)
+/// Returns 0x40 if the last page to buffer compare found a difference; otherwise 0.
+#define AT45_STATUS_COMPARE(status)     (((status) >> 8) & 0x40)
+
+/**
+ * One segment of a scatter-gather read
+ */
+struct at45_segment {
+    uint8_t     *buff;                          // data in CPU memory space
+    uint32_t    size;                           // number of bytes
+};
+
+/**
+ * One segment of a scatter-gather write
+ */
+struct at45_const_segment {
+    const uint8_t   *buff;                      // data in CPU memory space
+    uint32_t        size;                       // number of bytes
+};
+
+#if AT45_STATS
+/**
+ * Operation statistics since init or the last at45_reset_stats
+ */
+struct at45_stats {
+    uint32_t    commands[256];                  // commands issued, by opcode
+    uint64_t    bytes;                          // bytes clocked, command headers included
+    uint64_t    spi_us;                         // time to clock 'bytes' at the SPI clock in use
+    uint64_t    wait_us;                        // time spent in at45_wait_ready
+    uint32_t    waits;                          // at45_wait_ready calls
+    uint32_t    timeouts;                       // waits that timed out
+    uint32_t    ep_failures;                    // erase or program failures reported
+};
+#endif  // AT45_STATS
+
+/// Returns 1 if the manufacture and device ID are correct.
+#define AT45_MANU_AND_DEVICE_ID(id)     ((id) == 0x1f260001)
+
+// bus policy methods on the command path are always inlined, even at -Os
+#if defined(__ICCARM__)
+#define AT45_INLINE         _Pragma("inline=forced") inline
+#elif defined(__GNUC__) || defined(__clang__) || defined(__CC_ARM)
+#define AT45_INLINE         inline __attribute__((always_inline))
+#else
+#define AT45_INLINE         inline
+#endif
+
+#ifndef AT45DB_DEBUG
+#define AT45DB_DEBUG        1                   // report the device found at init through Bus::debug
+#endif  // AT45DB_DEBUG
+
+/**
+ * Names shared by every AT45DBCore instantiation
+ */
+class AT45DBTypes
+{
+
+public:
+
+    /**
+     *  @enum CMDCODES
+     *  @brief The device command register table for the AT45DB
+     */
+
+    enum CMDCODES
+    {
+        AT45_PAGE_READ              = 0xD2,         /// Main memory page read command code.
+        AT45_CONTINUOUS_READ_LEG    = 0xE8,         /// Continous array read (legacy) command code.
+        AT45_CONTINUOUS_READ_LF     = 0x03,         /// Continous array read (low frequency) command code.
+        AT45_CONTINUOUS_READ_LP     = 0x01,         /// Continous array read (low power) command code.
+        AT45_CONTINUOUS_READ        = 0x0B,         /// Continous array read command code.
+        AT45_BUF1_READ_LF           = 0xD1,         /// Buffer 1 read (low frequency) command code.
+        AT45_BUF2_READ_LF           = 0xD3,         /// Buffer 2 read (low frequency) command code.
+        AT45_BUF1_READ_SER          = 0xD4,         /// Buffer 1 read (serial) command code.
+        AT45_BUF2_READ_SER          = 0xD6,         /// Buffer 2 read (serial) command code.
+        AT45_BUF1_READ_8B           = 0x54,         /// Buffer 1 read (8-bit) command code.
+        AT45_BUF2_READ_8B           = 0x56,         /// Buffer 2 read (8-bit) command code.
+        AT45_BUF1_WRITE             = 0x84,         /// Buffer 1 write command code.
+        AT45_BUF2_WRITE             = 0x87,         /// Buffer 2 write command code.
+        AT45_BUF1_MEM_ERASE         = 0x83,         /// Buffer 1 to main memory page program with erase command code.
+        AT45_BUF2_MEM_ERASE         = 0x86,         /// Buffer 2 to main memory page program with erase command code.
+        AT45_BUF1_MEM_NOERASE       = 0x88,         /// Buffer 1 to main memory page program without erase command code.
+        AT45_BUF2_MEM_NOERASE       = 0x89,         /// Buffer 2 to main memory page program without erase command code.
+        AT45_PAGE_ERASE             = 0x81,         /// Page erase command code.
+        AT45_BLOCK_ERASE            = 0x50,         /// Block erase command code.
+        AT45_SECTOR_ERASE           = 0x7C,         /// Sector erase command code.
+        AT45_CHIP_ERASE_FIRST       = 0xC7,         /// Chip erase command code.
+        AT45_PAGE_WRITE_BUF1        = 0x82,         /// Main memory page program through buffer 1 command code.
+        AT45_PAGE_WRITE_BUF2        = 0x85,         /// Main memory page program through buffer 2 command code.
+        AT45_BUFFER_WRITE_BUF1      = 0x84,         /// Buffer Write to buffer 1 command code.
+        AT45_BUFFER_WRITE_BUF2      = 0x87,         /// Buffer Write to buffer 2 command code.
+        AT45_BUFFER_TO_MAIN_MEMORY_BUF1  = 0x83,    /// Buffer to Main memory page through buffer 1 command code.
+        AT45_BUFFER_TO_MAIN_MEMORY_BUF2  = 0x86,    /// Buffer to Main memory page through buffer 2 command code.
+        AT45_PAGE_BUF1_TX           = 0x53,         /// Main memory page to buffer 1 transfer command code.
+        AT45_PAGE_BUF2_TX           = 0x55,         /// Main memory page to buffer 2 transfer command code.
+        AT45_PAGE_BUF1_CMP          = 0x60,         /// Main memory page to buffer 1 compare command code.
+        AT45_PAGE_BUF2_CMP          = 0x61,         /// Main memory page to buffer 2 compare command code.
+        AT45_AUTO_REWRITE_BUF1      = 0x58,         /// Auto page rewrite through buffer 1 command code.
+        AT45_AUTO_REWRITE_BUF2      = 0x59,         /// Auto page rewrite through buffer 2 command code.
+        AT45_ULTRA_DEEP_PDOWN       = 0x79,         /// Ultra Deep power-down command code.
+        AT45_DEEP_PDOWN             = 0xB9,         /// Deep power-down command code.
+        AT45_RES_DEEP_PDOWN         = 0xAB,         /// Resume from deep power-down command code.
+        AT45_STATUS_READ            = 0xD7,         /// Status register read command code.
+        AT45_ID_READ                = 0x9F,         /// Manufacturer and device ID read command code.
+        AT45_BINARY_PAGE_FIRST_OPCODE   = 0x3D,     /// Power-of-2 binary page size configuration command code.
+    };
+
+    /**
+     *  @enum READMODES
+     *  @brief Caller preference when selecting a continuous read opcode
+     */
+
+    enum READMODES
+    {
+        AT45_READ_FAST              = 0,            /// Fewest command bytes at the configured SPI clock.
+        AT45_READ_LOW_POWER         = 1,            /// Low power read where the SPI clock allows it.
+    };
+
+    /**
+     *  @enum BUFFERS
+     *  @brief The two on-chip SRAM buffers
+     */
+
+    enum BUFFERS
+    {
+        AT45_BUFFER1                = 0,            /// SRAM buffer 1.
+        AT45_BUFFER2                = 1,            /// SRAM buffer 2.
+    };
+
+    /**
+     *  @enum OPERATIONS
+     *  @brief Internally timed operations, used to pace ready polling
+     */
+
+    enum OPERATIONS
+    {
+        AT45_OP_TRANSFER            = 0,            /// Page to buffer transfer or compare.
+        AT45_OP_PROGRAM             = 1,            /// Buffer to page program without erase.
+        AT45_OP_ERASE_PROGRAM       = 2,            /// Page erase and program.
+        AT45_OP_PAGE_ERASE          = 3,            /// Page erase.
+        AT45_OP_BLOCK_ERASE         = 4,            /// Block erase.
+        AT45_OP_SECTOR_ERASE        = 5,            /// Sector erase.
+        AT45_OP_CHIP_ERASE          = 6,            /// Chip erase.
+        AT45_OP_CONFIG              = 7,            /// Nonvolatile configuration register program.
+    };
+
+    /**
+     *  @enum RESULTS
+     *  @brief Result codes for operations that can fail in more than one way
+     */
+
+    enum RESULTS
+    {
+        AT45_OK                     = 0,            /// Operation completed.
+        AT45_ERR_TIMEOUT            = -1,           /// Device still busy at the timeout.
+        AT45_ERR_EP                 = -2,           /// Erase or program failed.
+        AT45_ERR_PARAM              = -3,           /// Address or length not valid for the operation.
+        AT45_ERR_BUS                = -4,           /// Async SPI transfer failed.
+        AT45_BUSY                   = 1,            /// Async operation still in progress.
+    };
+};
+
+/**
+ * AT45DB driver core over a bus policy
+ *
+ * The driver is written once against 'Bus', a class that owns the SPI 
+ * port and chip select. Every call on the bus is a direct (non-virtual)
+ * call on a member, so with the policy methods defined in their headers
+ * (AT45_INLINE on the command path) the compiler inlines them into the 
+ * driver and the core costs the same as a driver written straight 
+ * against that port.
+ *
+ * A Bus provides:
+ *
+ *  void     init(uint32_t hz, uint8_t fill)  set the clock, CS high, 'fill' clocked out when only receiving
+ *  void     select(void)                     take the bus and assert CS
+ *  void     deselect(void)                   release CS (starts internally timed operations) and the bus
+ *  void     transfer(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len)
+ *                                            full duplex block transfer of max(tx_len, rx_len) bytes,
+ *                                            either pointer may be NULL with a zero length
+ *  void     wait_us(uint32_t us)             busy wait
+ *  void     sleep_ms(uint32_t ms)            let other threads run for 'ms'
+ *  void     yield(void)                      let other threads run
+ *  uint32_t now_ms(void)                     free running millisecond clock
+ *  uint32_t now_us(void)                     free running microsecond clock
+ *  static void debug(const char *fmt, ...)   diagnostic output
+ *
+ * and for the non-blocking calls, where DEVICE_SPI_ASYNCH is set:
+ *
+ *  void     lock(void), unlock(void)         take and release the bus (thread context)
+ *  void     cs_low(void), cs_high(void)      drive CS without taking the bus (cs_high from interrupt context)
+ *  void     transfer_async(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len,
+ *                          const Callback<void(int)> &done)
+ *
+ * Policies supplied: AT45DBMbedBus (mbed SPI + DigitalOut, this is the
+ * AT45DB typedef), AT45DBSpidevBus (Linux spidev) and AT45DBSimBus 
+ * (the AT45DBSim model on a host).
+ */
+template <class Bus>
+class AT45DBCore : public AT45DBTypes
+{
+
+public:
+
+    /**
+     * Adesto AT45DB Low Power and Wide Vcc SPI-Flash Memory Family 
+     *
+     * @param args = passed on to the Bus constructor, for AT45DBMbedBus
+     *               the mosi, miso, sclk and cs pins
+     */
+    template <typename... Args>
+    AT45DBCore(Args&&... args);
+     
+    ~AT45DBCore() ;
+     
+    /*
+     * Geometry of the part in use: the AT45_DEVICE entry of at45_devices,
+     * or with AT45_DEVICE 0 the entry for the ID read at init (the 
+     * AT45DB161E if the ID is not known). With a fixed part these are
+     * compile time constants.
+     */
+    const at45_device &at45_device_info(void) const
+    {
+#if AT45_DEVICE
+        return *at45_fixed_device;
+#else
+        return *_at45_dev;
+#endif  // AT45_DEVICE
+    }
+
+    uint32_t at45_page_size(void) const
+    {
+        return AT45DBCore::at45_device_info().page_size;
+    }
+
+    uint32_t at45_page_count(void) const
+    {
+        return AT45DBCore::at45_device_info().page_count;
+    }
+
+    uint32_t at45_block_pages(void) const
+    {
+        return AT45DBCore::at45_device_info().block_pages;
+    }
+
+    uint32_t at45_sector_pages(void) const
+    {
+        return AT45DBCore::at45_device_info().sector_pages;
+    }
+
+    /*
+     * @param cap = AT45_CAP_* feature
+     * @return true if the part in use has it
+     */
+    bool at45_has(uint32_t cap) const
+    {
+        return (AT45DBCore::at45_device_info().caps & cap) != 0;
+    }
+
+    /*
+     * Read status byte from Adesto AT45DB serial flash chip
+     *
+     * @return 16bit value with status byte1 in the upper byte and byte2 (0 on parts without it) in the lower byte.
+     */
+    uint16_t at45_get_status(void);
+    
+    /* Read the ID value from the chip.
+     *
+     * @return 32 bit unsigned integer: 00, manufacturer, device family, device series
+     */
+    unsigned int at45_get_id(void);
+
+    /* 
+     * Read data directly from a single page in the main memory, 
+     * bypassing both of the data buffers and leaving the contents 
+     * of the buffers unchanged.
+     *
+     * When the end of a page in main memory is reached, the device will
+     * continue reading back at the beginning of the same page rather 
+     * than the beginning of the next page.
+     *
+     * If either SRAM buffer is known to hold a copy of the page, the data
+     * is read from that buffer instead (D1h/D3h or D4h/D6h), which needs
+     * at most one dummy byte.
+     *
+     * Opcode (D2h) + 3-byte address + 4-byte dummy
+     *
+     * @param addr = address from which to start reading
+     * @param *buff = pointer to destination memory buffer
+     * @param size = number of bytes to read
+     * @return true = success
+     */
+    bool at45_readpage(uint32_t addr, uint8_t *buff, uint32_t size);
+
+    /*
+     * Read any number of bytes from main memory with the Continuous 
+     * Array Read command. The address advances across page boundaries
+     * within a single CS assertion and wraps from the end of the array 
+     * back to the beginning, so a multi-page read costs one command frame.
+     *
+     * The opcode is chosen once at init from the SPI clock (AT45_SPI_FREQ,
+     * limited to the part's maximum): the one with
+     * the fewest dummy bytes that is valid at that clock, or the low power
+     * opcode (01h) if requested and the clock is within its limit.
+     *
+     * Opcode (01h, 03h, 0Bh or E8h) + 3-byte address + 0, 1 or 4 dummy bytes
+     *
+     * @param addr = address from which to start reading
+     * @param *buff = pointer to destination memory buffer
+     * @param size = number of bytes to read
+     * @param mode = AT45_READ_FAST or AT45_READ_LOW_POWER
+     * @return true = success
+     */
+    bool at45_read(uint32_t addr, uint8_t *buff, uint32_t size, READMODES mode = AT45_READ_FAST);
+
+    /*
+     * As at45_read, scattering the data over several segments in order.
+     * All segments are read in one CS assertion.
+     *
+     * @param addr = address from which to start reading
+     * @param *seg = array of segments, in order
+     * @param count = number of segments
+     * @param mode = AT45_READ_FAST or AT45_READ_LOW_POWER
+     * @return true = success
+     */
+    bool at45_readv(uint32_t addr, const at45_segment *seg, uint32_t count, READMODES mode = AT45_READ_FAST);
+
+#if AT45_HAS_SPAN
+    /*
+     * Span based forms of at45_read, at45_readpage and at45_writepage
+     */
+    bool at45_read(uint32_t addr, Span<uint8_t> buff, READMODES mode = AT45_READ_FAST);
+    bool at45_readpage(uint32_t addr, Span<uint8_t> buff);
+    bool at45_writepage(uint32_t addr, Span<const uint8_t> buff);
+#endif  // AT45_HAS_SPAN
+
+    /*
+     * With the Main Memory Page Program through Buffer with Built-In Erase command, 
+     * data is first clocked into either Buffer 1 or Buffer 2, the addressed page in 
+     * memory is then automatically erased, and then the contents of the appropriate 
+     * buffer are programmed into the just-erased main memory page.
+     *
+     * When there is a low-to-high transition on the CS pin, the device will first 
+     * erase the selected page in main memory (the erased state is a Logic 1) and 
+     * then program the data stored in the buffer into that main memory page.
+     *
+     * Opcode (82h or 85h) + 3-byte address
+     *
+     * If the page is known to be erased (AT45_TRACK_ERASED) the erase is
+     * skipped: the data is written to the buffer (84h or 87h) and then
+     * programmed without erase (88h or 89h), roughly halving program time.
+     *
+     * With write elision enabled a whole page write is first compared
+     * against the page (60h or 61h) and not programmed if it is unchanged.
+     *
+     * NOTE: 1. The 'addr' should always align with the boundary of a page, 
+     *          otherwise the AT45's internal buffer may wrap.
+     *       2. The 'buff' should always contain a whole page's data, 
+     *          namely the 'size' should always be at45_page_size(), otherwise
+     *          uninitialised data in AT45's internal buffer would be 
+     *          programmed into the Main Memory page.
+     *
+     * @param addr = address to start writing into flash
+     * @param *buff = pointer to memory buffer to use as data source
+     * @param size = buffer size, should always be at45_page_size() bytes
+     * @return true = success
+     */
+    bool at45_writepage(uint32_t addr, const uint8_t *buff, uint32_t size);
+
+    /*
+     * As at45_writepage, with the page data gathered from several 
+     * segments. All segments are clocked out in one CS assertion, so a
+     * header and payload need not be copied into one buffer first.
+     *
+     * @param addr = address to start writing into flash
+     * @param *seg = array of segments, in order
+     * @param count = number of segments
+     * @return true = success
+     */
+    bool at45_writepagev(uint32_t addr, const at45_const_segment *seg, uint32_t count);
+
+    /*
+     * Writes data into the currently selected RAM buffer
+     *
+     * @param addr = destination address in RAM buffer (below at45_page_size())
+     * @param *buff = pointer to source in CPU memory space
+     * @param size = size - number of bytes to be transferred
+     * @return true = success
+     */
+    bool at45_writebuffer(uint32_t addr, const uint8_t *buff, uint32_t size);
+
+    /*
+     * Writes pre-loaded buffer into flash page
+     *
+     * @param addr = destination page address in flash (page aligned)
+     * @return true = success
+     */
+    bool at45_buffer2memory(uint32_t addr);
+
+    /*
+     * Writes data into the given RAM buffer. A buffer may be written
+     * while the device is programming a page from the other buffer.
+     *
+     * Opcode (84h or 87h) + 3-byte address (buffer offset in the low bits)
+     *
+     * @param buf = AT45_BUFFER1 or AT45_BUFFER2
+     * @param offset = destination offset in RAM buffer (below at45_page_size())
+     * @param *buff = pointer to source in CPU memory space
+     * @param size = number of bytes to be transferred
+     * @return true = success
+     */
+    bool at45_buffer_write(BUFFERS buf, uint32_t offset, const uint8_t *buff, uint32_t size);
+
+    /*
+     * Reads data from the given RAM buffer, wrapping at the end of the
+     * buffer. The low frequency opcode (no dummy byte) is used when the 
+     * SPI clock allows it.
+     *
+     * Opcode (D1h, D3h, D4h or D6h) + 3-byte address (+ 1-byte dummy)
+     *
+     * @param buf = AT45_BUFFER1 or AT45_BUFFER2
+     * @param offset = offset in RAM buffer (below at45_page_size())
+     * @param *buff = pointer to destination memory buffer
+     * @param size = number of bytes to read
+     * @return true = success
+     */
+    bool at45_readbuffer(BUFFERS buf, uint32_t offset, uint8_t *buff, uint32_t size);
+
+    /*
+     * @return address of the page the RAM buffer is known to hold a copy
+     *         of, or AT45_NO_PAGE
+     */
+    uint32_t at45_buffer_page(BUFFERS buf);
+
+    /*
+     * Programs the flash page from the given RAM buffer, with or without
+     * a built-in erase. Without erase only 1 bits can be cleared, so the
+     * page should already be erased. The device is busy until the 
+     * program completes.
+     *
+     * Opcode (83h, 86h, 88h or 89h) + 3-byte address
+     *
+     * @param buf = AT45_BUFFER1 or AT45_BUFFER2
+     * @param addr = destination page address in flash (page aligned)
+     * @param erase = erase the page before programming
+     * @return true = success
+     */
+    bool at45_buffer_program(BUFFERS buf, uint32_t addr, bool erase = true);
+
+    /*
+     * Transfers a main memory page into the given RAM buffer.
+     * The device is busy for up to 200us (tXFR).
+     *
+     * Opcode (53h or 55h) + 3-byte address
+     *
+     * @param buf = AT45_BUFFER1 or AT45_BUFFER2
+     * @param addr = source page address in flash (page aligned)
+     * @return true = success
+     */
+    bool at45_page2buffer(BUFFERS buf, uint32_t addr);
+
+    /*
+     * Compares a main memory page with the given RAM buffer. When the
+     * device is ready again AT45_STATUS_COMPARE gives the result.
+     *
+     * Opcode (60h or 61h) + 3-byte address
+     *
+     * @param buf = AT45_BUFFER1 or AT45_BUFFER2
+     * @param addr = page address in flash (page aligned)
+     * @return true = success
+     */
+    bool at45_page_compare(BUFFERS buf, uint32_t addr);
+
+    /*
+     * Enable or disable write elision for at45_writepage. When enabled,
+     * whole page writes are loaded into a buffer and compared with the
+     * page on chip; the erase/program cycle is skipped if they match,
+     * saving time and endurance for pages rewritten with the same data.
+     *
+     * @param enable = true to compare before programming
+     */
+    void at45_set_write_elision(bool enable);
+
+    /*
+     * @return number of page writes skipped because the page was unchanged
+     */
+    uint32_t at45_get_elided_writes(void);
+
+    /*
+     * @return number of page writes compared with the page on chip
+     */
+    uint32_t at45_get_compared_writes(void);
+
+    /*
+     * Update bytes in place using an on-chip read-modify-write: each page
+     * touched is transferred into a RAM buffer, only the changed bytes 
+     * are written to the buffer, and the buffer is programmed back.
+     * Only the new data and a few command bytes cross the SPI bus.
+     * The range may span several pages.
+     *
+     * @param addr = address in flash of the first byte to update
+     * @param *data = pointer to source in CPU memory space
+     * @param len = number of bytes to update
+     * @return true = success, false if the device did not become ready
+     *         or a page program of this call failed (a failure left over
+     *         from an earlier operation is not reported here)
+     */
+    bool at45_update(uint32_t addr, const uint8_t *data, uint32_t len);
+
+    /*
+     * test whether a flash page is erased, using the erased page map
+     * and reading the page the first time it is asked about
+     *
+     * @param addr = page address in flash (page aligned)
+     */
+    bool at45_is_page_erased(uint32_t addr);
+    
+    /*
+     * Erases flash page
+     *
+     * @param addr = destination page address in flash (page aligned)
+     * @return true = success
+     */
+    bool at45_erasepage(uint32_t addr);
+
+    /*
+     * Erases flash block of at45_block_pages() pages
+     *
+     * Opcode (50h) + 3-byte address
+     *
+     * @param addr = destination block address in flash (block aligned)
+     * @return true = success
+     */
+    bool at45_eraseblock(uint32_t addr);
+
+    /*
+     * Erases flash sector: sector 0a is block 0, sector 0b the rest of 
+     * the first at45_sector_pages() pages, and every later sector is 
+     * at45_sector_pages() pages (from the part's at45_devices entry).
+     *
+     * Opcode (7Ch) + 3-byte address
+     *
+     * @param addr = any address within the sector
+     * @return true = success
+     */
+    bool at45_erasesector(uint32_t addr);
+
+    /*
+     * Erases the entire main memory array
+     *
+     * Opcode (C7h, 94h, 80h, 9Ah)
+     *
+     * @return true = success
+     */
+    bool at45_erasechip(void);
+
+    /*
+     * Estimate the time to erase a page aligned range using the fewest,
+     * fastest combination of page, block, sector and chip erases 
+     * (datasheet typical times). This is the plan at45_erase_range follows.
+     *
+     * @param addr = start address in flash (page aligned)
+     * @param len = number of bytes, a multiple of the page size
+     * @return estimated duration in milliseconds, 0 if the range is not valid
+     */
+    uint32_t at45_erase_estimate(uint32_t addr, uint32_t len);
+
+    /*
+     * Erase a page aligned range, waiting for each erase to complete.
+     *
+     * @param addr = start address in flash (page aligned)
+     * @param len = number of bytes, a multiple of the page size
+     * @return AT45_OK, AT45_ERR_PARAM, AT45_ERR_TIMEOUT or AT45_ERR_EP
+     */
+    int at45_erase_range(uint32_t addr, uint32_t len);
+
+    /*
+     * In ultra deep power down mode it consumes less than 1uA.
+     * In ultra deep power down mode, all commands including the 
+     * Status Register Read and Resume from Deep Power-Down commands
+     * will be ignored. The RAM buffer contents are lost.
+     * Returns false, doing nothing, on parts without it (D series).
+     */
+    bool at45_ultra_deep_pwrdown_enter(void);
+
+    /* 
+     * exit from ultra deep power down mode by 
+     * asserting CS pin for more than 20ns, 
+     * deasserting the CS then wait for 120us.
+     * the RAM buffers are undefined after wake from deep power down
+     */
+    bool at45_ultra_deep_pwrdown_exit(void);
+
+    /*
+     * test for AT45DB chip ready
+     */
+    bool at45_is_ready(void);
+
+    /*
+     * test for erase failed status
+     */
+    bool at45_is_ep_failed(void);
+
+    /*
+     * Wait for the device to become ready after an internally timed 
+     * operation.
+     *
+     * Opcode (D7h) is sent and the status register is then sampled 
+     * continuously within the same CS assertion. Between samples the 
+     * calling thread sleeps, starting at about three quarters of the 
+     * typical time for 'op' and then backing off from an eighth of it.
+     * CS and the SPI bus are released for each sleep and D7h is sent 
+     * again after it; when an operation is too short to sleep for, the
+     * thread yields and the bus stays locked to this device.
+     *
+     * @param timeout_ms = give up after this long, AT45_WAIT_DEFAULT for
+     *                     twice the datasheet maximum for 'op'
+     * @param op = the operation in progress
+     * @param *status = if not NULL, receives the last status word read
+     * @return AT45_OK, AT45_ERR_TIMEOUT, or AT45_ERR_EP if an erase or
+     *         program operation reported failure
+     */
+    int at45_wait_ready(uint32_t timeout_ms, OPERATIONS op = AT45_OP_ERASE_PROGRAM, uint16_t *status = NULL);
+
+    /*
+     * Free running microsecond clock of the bus, for callers that work
+     * to a time budget
+     */
+    uint32_t at45_now_us(void)
+    {
+        return _bus.now_us();
+    }
+
+#if AT45_STATS
+    /*
+     * Operation statistics. Counting costs two increments per transfer 
+     * and one per command; spi_us is worked out here from the byte count
+     * rather than timed, so it excludes gaps between transfers. The time
+     * the device is busy but not waited for is not included anywhere.
+     *
+     * @return counters since init or the last at45_reset_stats
+     */
+    const at45_stats &at45_get_stats(void);
+
+    /*
+     * Zero the statistics
+     */
+    void at45_reset_stats(void);
+#endif  // AT45_STATS
+
+#if DEVICE_SPI_ASYNCH
+    /*
+     * Non-blocking variants of at45_readpage and at45_writepage.
+     *
+     * The bus is taken and the command header is clocked synchronously, 
+     * the payload is then moved by SPI::transfer() (DMA where the target
+     * supports it) and the call returns immediately. CS is released from
+     * the transfer completion handler, which for a write starts the 
+     * erase/program cycle.
+     *
+     * 'done' (may be empty) is called in interrupt context when the 
+     * payload has been clocked, with the SPI event flags. It must not 
+     * call the driver; it can wake the thread that started the operation,
+     * which then calls at45_async_poll until it stops returning AT45_BUSY.
+     *
+     * 'buff' must remain valid, and the driver must not be used otherwise,
+     * until at45_async_poll has returned a result. The bus stays locked 
+     * until the first poll after the transfer.
+     *
+     * @return true = transfer started, false = an async operation is in progress
+     */
+    bool at45_readpage_async(uint32_t addr, uint8_t *buff, uint32_t size, Callback<void(int)> done);
+    bool at45_writepage_async(uint32_t addr, const uint8_t *buff, uint32_t size, Callback<void(int)> done);
+
+    /*
+     * Finish an async operation, from the thread that started it. Once 
+     * the transfer is over the bus is released; a write is then finished
+     * when the page program is. Does not block.
+     *
+     * @return AT45_BUSY = transfer or page program still in progress,
+     *         AT45_OK, AT45_ERR_EP (program failed) or AT45_ERR_BUS (SPI
+     *         transfer failed) once finished, AT45_OK if none was started
+     */
+    int at45_async_poll(void);
+
+    /*
+     * test for an async operation not yet finished by at45_async_poll
+     */
+    bool at45_async_busy(void);
+#endif  // DEVICE_SPI_ASYNCH
+ 
+
+private:
+
+    Bus             _bus;
+    unsigned int    _at45id;
+#if !AT45_DEVICE
+    const at45_device   *_at45_dev = at45_find_device(AT45DB161E_ID);
+#endif  // AT45_DEVICE
+    uint32_t        _at45_freq = AT45_SPI_FREQ; // SPI clock, limited to the part's maximum
+    bool            _at45_buffer = true;
+    bool            _g_at45_buffer = true;
+    uint8_t         _at45_rdop[2];              // continuous read opcode per READMODES
+    uint8_t         _at45_rddummy[2];           // dummy bytes after the address per READMODES
+    uint32_t        _at45_bufpage[2] = {AT45_NO_PAGE, AT45_NO_PAGE};   // page copied in each SRAM buffer
+    bool            _at45_bufrd_lf;             // buffer reads without dummy byte at this clock
+    bool            _at45_elide = false;        // compare whole page writes before programming
+    uint32_t        _at45_elided = 0;           // writes skipped as unchanged
+    uint32_t        _at45_compared = 0;         // writes compared
+#if AT45_STATS
+    at45_stats      _at45_stats;
+    bool            _at45_stat_cmd = false;     // next transfer starts a command
+#endif  // AT45_STATS
+#if AT45_TRACK_ERASED
+    uint8_t         _at45_known[AT45_PAGE_COUNT / 8];   // page state has been determined
+    uint8_t         _at45_erased[AT45_PAGE_COUNT / 8];  // page is known to be erased
+    uint32_t        _at45_erasing = 0;          // first page of an erase not yet seen to complete
+    uint32_t        _at45_erasing_count = 0;    // ... and its number of pages, 0 = none
+#endif  // AT45_TRACK_ERASED
+#if DEVICE_SPI_ASYNCH
+    enum ASYNCSTATE {
+        AT45_ASYNC_IDLE,
+        AT45_ASYNC_TRANSFER,                    // payload on the bus, bus locked
+        AT45_ASYNC_DONE,                        // transfer over (set in interrupt context), bus locked
+        AT45_ASYNC_PROGRAM,                     // bus released, page program running
+    };
+    core_util_atomic_flag   _at45_async_claim = CORE_UTIL_ATOMIC_FLAG_INIT; // set while an operation is not finished
+    volatile ASYNCSTATE     _at45_async_state = AT45_ASYNC_IDLE;
+    volatile int            _at45_async_event = 0;
+    bool                    _at45_async_write = false;
+    Callback<void(int)>     _at45_async_done;
+#endif  // DEVICE_SPI_ASYNCH
+    
+    /** Initialise the device and SPI
+     *  Set to the power on reset conditions
+     *  @return - ID of attached device, 0 = none configured
+     */
+    unsigned int init(void);
+
+    /*
+     * Set page size to binary, at45_page_size() bytes per page (chip 
+     * default is 8 bytes more per 256, e.g. 528 for 512)
+     *
+     * The configured setting is stored in an internal nonvolatile 
+     * register so that the buffer and page size configuration is 
+     * not affected by power cycles. 
+     *
+     * NOTE: The nonvolatile register has a limit of 10,000 erase/program 
+     * cycles; therefore, care should be taken to not switch
+     * between the size options more than 10,000 times.
+     *
+     * @return: TURE if in binary mode; otherwise FALSE.
+     */
+    bool at45_set_pagesize_binary(void);
+
+    /*
+     * Select the continuous read opcode for a READMODES preference
+     * at the given SPI clock frequency.
+     */
+    void at45_select_read_opcode(READMODES mode, uint32_t freq);
+
+    /*
+     * Typical or maximum duration of 'op' in microseconds on this part
+     */
+    uint32_t at45_op_us(OPERATIONS op, bool max);
+
+    /*
+     * Walk the erase plan for a page range, optionally issuing the 
+     * erases, and return the estimated time in microseconds.
+     */
+    uint32_t at45_erase_plan(uint32_t page, uint32_t count, bool execute, int *result);
+
+    /*
+     * Command framing helpers. Each command is one CS assertion
+     * with header and payload clocked as block transfers.
+     */
+    void at45_select(void);
+    void at45_deselect(void);
+    void at45_transfer(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len);
+    void at45_command(uint8_t *opcode, uint8_t cmd, uint32_t addr);
+
+    /*
+     * Erased page map: record the state of a page after an erase or 
+     * program, and read a page to find out its state when unknown.
+     * Erased pages are recorded when the erase is sent; at45_wait_ready
+     * makes them unknown again if the erase then fails or times out.
+     */
+    void at45_mark_page(uint32_t addr, bool erased);
+    void at45_mark_pages(uint32_t addr, uint32_t count, bool erased);
+    void at45_mark_erasing(uint32_t addr, uint32_t count);
+    void at45_erase_done(bool ok);
+    bool at45_probe_erased(uint32_t addr);
+    bool at45_known_erased(uint32_t addr);
+
+    /*
+     * SRAM buffer residency: record that a buffer now matches a page
+     * (or nothing), and find the buffer holding a page, -1 if neither.
+     */
+    void at45_buffer_holds(BUFFERS buf, uint32_t addr);
+
+    /*
+     * Scatter-gather forms of the buffer read and write commands
+     */
+    bool at45_buffer_writev(BUFFERS buf, uint32_t offset, const at45_const_segment *seg, uint32_t count);
+    bool at45_readbufferv(BUFFERS buf, uint32_t offset, const at45_segment *seg, uint32_t count);
+    int at45_buffer_find(uint32_t addr);
+
+#if DEVICE_SPI_ASYNCH
+    /*
+     * Async completion: the SPI handler runs in interrupt context, 
+     * releases CS and leaves the rest to at45_async_poll.
+     */
+    void at45_async_complete(int event);
+#endif  // DEVICE_SPI_ASYNCH
+
+};
+
+#include "AT45DBCore_impl.h"
+
+#endif // _AT45DBCORE_H_
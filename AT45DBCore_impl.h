@@ -0,0 +1,1346 @@
+/* 
+ * @file    AT45DBCore_impl.h
+ * @brief   Device driver - Adesto AT45DB serial flash driver core, member definitions
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+ 
+/*
+ * Included from AT45DBCore.h; not for direct use.
+ */
+
+#ifndef _AT45DBCORE_IMPL_H_
+#define _AT45DBCORE_IMPL_H_
+
+/* 
+ * Its 17,301,504 bits of memory are organized as 4,096 pages of 
+ * 512 bytes or 528 bytes each. In addition to the main memory, 
+ * the AT45DB161E also contains two SRAM buffers of 512/528 bytes 
+ * each. The buffers allow receiving of data while a page in the 
+ * main memory is being reprogrammed.
+ *
+ * NOTE: All instructions, addresses, and data are 
+ * transferred with the Most Significant
+ * Bit (MSB) first.
+ */
+
+/*
+ * Typical and maximum duration of each OPERATIONS entry in microseconds
+ * (AT45DB161E: tXFR, tP, tEP, tPE, tBE, tSE, tCE; configuration as tEP)
+ */
+static const struct {
+    uint32_t    typ_us;
+    uint32_t    max_us;
+} at45_op_times[] = {
+    {      100,      200 },         // AT45_OP_TRANSFER
+    {     2000,     4000 },         // AT45_OP_PROGRAM
+    {    12000,    35000 },         // AT45_OP_ERASE_PROGRAM
+    {     8000,    35000 },         // AT45_OP_PAGE_ERASE
+    {    30000,    75000 },         // AT45_OP_BLOCK_ERASE
+    {   700000,  1300000 },         // AT45_OP_SECTOR_ERASE
+    { 22000000, 40000000 },         // AT45_OP_CHIP_ERASE
+    {    12000,    35000 },         // AT45_OP_CONFIG
+};
+
+/*
+ * Continuous array read opcodes in order of preference, with the number 
+ * of dummy bytes following the address and the maximum SPI clock at 
+ * which each may be used (AT45DB161E, fCAR1 / fCAR2 / fCAR3).
+ */
+static const struct {
+    uint8_t     opcode;
+    uint8_t     dummy;
+    uint32_t    max_freq;
+} at45_read_opcodes[] = {
+    { AT45DBTypes::AT45_CONTINUOUS_READ_LP,  0, 15000000 },
+    { AT45DBTypes::AT45_CONTINUOUS_READ_LF,  0, 50000000 },
+    { AT45DBTypes::AT45_CONTINUOUS_READ,     1, 85000000 },
+    { AT45DBTypes::AT45_CONTINUOUS_READ_LEG, 4, 85000000 },
+};
+
+template <class Bus>
+template <typename... Args>
+AT45DBCore<Bus>::AT45DBCore(Args&&... args) :
+        _bus(std::forward<Args>(args)...)
+{ 
+#if AT45_TRACK_ERASED
+    // nothing is known about any page until it is touched
+    memset(_at45_known, 0, sizeof(_at45_known));
+    memset(_at45_erased, 0, sizeof(_at45_erased));
+#endif  // AT45_TRACK_ERASED
+#if AT45_STATS
+    memset(&_at45_stats, 0, sizeof(_at45_stats));
+#endif  // AT45_STATS
+    _at45id = AT45DBCore::init();
+    return;
+}
+ 
+template <class Bus>
+AT45DBCore<Bus>::~AT45DBCore() { }
+
+template <class Bus>
+unsigned int AT45DBCore<Bus>::init(void)
+{
+    unsigned int at45dbid = 0;
+    const at45_device *dev;
+    
+    // set CS high, set up frequency for serial flash SPI and
+    // clock DUMMY out on block transfers that only receive
+    _bus.init(_at45_freq, DUMMY);
+    
+    // read device ID and look up the part
+    at45dbid = AT45DBCore::at45_get_id();
+#if AT45_DEVICE
+    dev = (at45dbid == AT45_DEVICE) ? at45_fixed_device : NULL;
+#else
+    dev = at45_find_device(at45dbid);
+    if (dev != NULL) {
+        _at45_dev = dev;
+    }
+#endif  // AT45_DEVICE
+    if (dev != NULL) {
+#if AT45DB_DEBUG
+        Bus::debug("AT45DB %x found, %u pages of %u bytes\n", at45dbid, dev->page_count, dev->page_size);
+#endif
+        // the ID is read at any clock; slow down for parts rated below it
+        if (_at45_freq > dev->max_clock) {
+            _at45_freq = dev->max_clock;
+            _bus.init(_at45_freq, DUMMY);
+        }
+    } else {
+#if AT45DB_DEBUG
+        Bus::debug("SFlash wrong ID: %x\n",at45dbid);
+#endif
+        at45dbid = 0;
+    }
+    // choose the continuous read opcodes for this clock
+    AT45DBCore::at45_select_read_opcode(AT45_READ_FAST, _at45_freq);
+    AT45DBCore::at45_select_read_opcode(AT45_READ_LOW_POWER, _at45_freq);
+    _at45_bufrd_lf = (_at45_freq <= 50000000);
+    
+    // read status byte
+    uint16_t status = AT45DBCore::at45_get_status();
+    // configure for binary page size
+    if (AT45_STATUS_BINARY(status)) {
+#if AT45DB_DEBUG
+        Bus::debug("AT45DB binary page size, SPI frequency %d\n",_at45_freq);
+#endif
+    } else {
+        if (AT45DBCore::at45_set_pagesize_binary()) {
+#if AT45DB_DEBUG
+            Bus::debug("AT45DB binary page size\n");
+#endif
+        } else {
+            at45dbid = 0;           // reset ID is page size not configured correctly
+#if AT45DB_DEBUG
+            Bus::debug("AT45DB NOT binary page size\n");
+#endif
+        }
+    }
+    
+    return at45dbid;
+}
+
+/*
+ * Return 16bit value with status byte1 in the upper byte 
+ * and byte2 in the lower byte.
+ */
+template <class Bus>
+uint16_t AT45DBCore<Bus>::at45_get_status(void)
+{
+    uint8_t     opcode[3];
+    uint8_t     data[3];
+    
+    opcode[0] = AT45_STATUS_READ;
+    opcode[1] = opcode[2] = DUMMY;
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 3, data, 3);      // opcode, byte1, byte2
+    AT45DBCore::at45_deselect();
+    if (!AT45DBCore::at45_has(AT45_CAP_STATUS2)) {
+        data[2] = 0;            // byte1 again
+    }
+    return (uint16_t)((data[1] << 8) | data[2]);
+}
+
+/* Read the ID value from the chip.
+ * Return 32 bit unsigned integer, 00, manufacturer, device family, device series
+ */
+template <class Bus>
+unsigned int AT45DBCore<Bus>::at45_get_id(void)
+{
+    uint8_t         opcode[4];
+    uint8_t         data[4];
+    unsigned int    data32;
+    
+    opcode[0] = AT45_ID_READ;
+    opcode[1] = opcode[2] = opcode[3] = DUMMY;
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, data, 4);      // opcode, then 3 ID bytes
+    AT45DBCore::at45_deselect();
+    data32 = (data[1] << 16) | (data[2] << 8) | data[3];
+    _at45id = data32;
+    return data32 ;
+}
+
+/*
+ * The configured setting is stored in an internal nonvolatile 
+ * register so that the buffer and page size configuration is 
+ * not affected by power cycles. 
+ *
+ * NOTE: The nonvolatile register has a limit of 10,000 erase/program 
+ * cycles; therefore, care should be taken to not switch
+ * between the size options more than 10,000 times.
+ *
+ * return: TURE if in binary mode; otherwise FALSE.
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_set_pagesize_binary(void)
+{
+    uint16_t status;
+    uint8_t devcmd[] = {AT45_BINARY_PAGE_FIRST_OPCODE,AT45_BINARY_PAGE};
+
+    status = AT45DBCore::at45_get_status();
+    if (!AT45_STATUS_BINARY(status)) {
+        AT45DBCore::at45_select();
+        AT45DBCore::at45_transfer(devcmd, sizeof(devcmd), NULL, 0);
+        AT45DBCore::at45_deselect();
+        if (AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, AT45_OP_CONFIG, &status) != AT45_OK) {
+            return 0;
+        }
+    }
+    return AT45_STATUS_BINARY(status);
+}
+
+/* 
+ * Read data directly from a single page in the main memory, 
+ * bypassing both of the data buffers and leaving the contents 
+ * of the buffers unchanged.
+ *
+ * When the end of a page in main memory is reached, the device will
+ * continue reading back at the beginning of the same page rather 
+ * than the beginning of the next page.
+ *
+ * Opcode (D2h) + 3-byte address + 4-byte dummy
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_readpage(uint32_t addr, uint8_t *buff, uint32_t size)
+{
+    uint8_t     opcode[8];
+    int         buf;
+    
+    // a buffer holding a copy of the page is cheaper to read
+    buf = AT45DBCore::at45_buffer_find(addr);
+    if (buf >= 0) {
+        return AT45DBCore::at45_readbuffer((BUFFERS)buf, addr % AT45DBCore::at45_page_size(), buff, size);
+    }
+
+    AT45DBCore::at45_command(opcode, AT45_PAGE_READ, addr);
+    opcode[4] = opcode[5] = opcode[6] = opcode[7] = DUMMY;
+    // now send command to chip and read back data
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 8, NULL, 0);
+    AT45DBCore::at45_transfer(NULL, 0, buff, size);
+    AT45DBCore::at45_deselect();
+    return 1;
+}
+
+/*
+ * Read from main memory with the Continuous Array Read command.
+ * The internal address counter runs on into the next page, so the 
+ * whole range is streamed in one CS assertion. With at most one dummy
+ * byte the header is also shorter than the 8-byte header of the page
+ * read, so this is never slower, even for a few bytes.
+ *
+ * Opcode (01h, 03h, 0Bh or E8h) + 3-byte address + 0, 1 or 4 dummy bytes
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_read(uint32_t addr, uint8_t *buff, uint32_t size, READMODES mode)
+{
+    at45_segment    seg = {buff, size};
+
+    return AT45DBCore::at45_readv(addr, &seg, 1, mode);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_readv(uint32_t addr, const at45_segment *seg, uint32_t count, READMODES mode)
+{
+    uint8_t     opcode[8];
+    uint32_t    i, len;
+    uint32_t    size = 0;
+    int         buf;
+    
+    for (i=0; i<count; i++) {
+        size += seg[i].size;
+    }
+    // a read within one page held in a buffer is served from the buffer
+    if ((addr % AT45DBCore::at45_page_size()) + size <= AT45DBCore::at45_page_size()) {
+        buf = AT45DBCore::at45_buffer_find(addr);
+        if (buf >= 0) {
+            return AT45DBCore::at45_readbufferv((BUFFERS)buf, addr % AT45DBCore::at45_page_size(), seg, count);
+        }
+    }
+
+    AT45DBCore::at45_command(opcode, _at45_rdop[mode], addr);
+    opcode[4] = opcode[5] = opcode[6] = opcode[7] = DUMMY;
+    len = 4 + _at45_rddummy[mode];
+    // now send command to chip and read back data
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, len, NULL, 0);
+    for (i=0; i<count; i++) {
+        AT45DBCore::at45_transfer(NULL, 0, seg[i].buff, seg[i].size);
+    }
+    AT45DBCore::at45_deselect();
+    return 1;
+}
+
+#if AT45_HAS_SPAN
+template <class Bus>
+bool AT45DBCore<Bus>::at45_read(uint32_t addr, Span<uint8_t> buff, READMODES mode)
+{
+    return AT45DBCore::at45_read(addr, buff.data(), buff.size(), mode);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_readpage(uint32_t addr, Span<uint8_t> buff)
+{
+    return AT45DBCore::at45_readpage(addr, buff.data(), buff.size());
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_writepage(uint32_t addr, Span<const uint8_t> buff)
+{
+    return AT45DBCore::at45_writepage(addr, buff.data(), buff.size());
+}
+#endif  // AT45_HAS_SPAN
+
+/*
+ * With the Main Memory Page Program through Buffer with Built-In Erase command, 
+ * data is first clocked into either Buffer 1 or Buffer 2, the addressed page in 
+ * memory is then automatically erased, and then the contents of the appropriate 
+ * buffer are programmed into the just-erased main memory page.
+ *
+ * When there is a low-to-high transition on the CS pin, the device will first 
+ * erase the selected page in main memory (the erased state is a Logic 1) and 
+ * then program the data stored in the buffer into that main memory page.
+ *
+ * Opcode (82h or 85h) + 3-byte address
+ *
+ * NOTE: 1. The 'addr' should always align with the boundary of a page, 
+ *          otherwise the AT45's internal buffer may wrap.
+ *       2. The 'buff' should always contain a whole page's data, 
+ *          namely the 'size' should always be 512, otherwise
+ *          uninitialised data in AT45's internal buffer would be 
+ *          programmed into the Main Memory page.
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_writepage(uint32_t addr, const uint8_t *buff, uint32_t size)
+{
+    at45_const_segment  seg = {buff, size};
+
+    return AT45DBCore::at45_writepagev(addr, &seg, 1);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_writepagev(uint32_t addr, const at45_const_segment *seg, uint32_t count)
+{
+    uint8_t     opcode[4];
+    uint16_t    status;
+    uint32_t    i;
+    uint32_t    size = 0;
+
+    for (i=0; i<count; i++) {
+        size += seg[i].size;
+    }
+
+    // compare a whole page against the chip and program only if different
+    if (_at45_elide && (size == AT45DBCore::at45_page_size()) && !AT45DBCore::at45_known_erased(addr)) {
+        BUFFERS buf = _at45_buffer ? AT45_BUFFER1 : AT45_BUFFER2;
+        _at45_buffer = !_at45_buffer;
+        AT45DBCore::at45_buffer_writev(buf, 0, seg, count);
+        // an EP bit here is left over from an earlier program, not this write
+        if (AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, AT45_OP_ERASE_PROGRAM) == AT45_ERR_TIMEOUT) {
+            return 0;
+        }
+        AT45DBCore::at45_page_compare(buf, addr);
+        if (AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, AT45_OP_TRANSFER, &status) != AT45_OK) {
+            return 0;
+        }
+        _at45_compared++;
+        if (!AT45_STATUS_COMPARE(status)) {
+            AT45DBCore::at45_buffer_holds(buf, addr);
+            _at45_elided++;
+            return 1;
+        }
+        return AT45DBCore::at45_buffer_program(buf, addr, true);
+    }
+
+#if AT45_TRACK_ERASED
+    // an erased page only needs programming: buffer write + 88h/89h
+    if (AT45DBCore::at45_is_page_erased(addr)) {
+        BUFFERS buf = _at45_buffer ? AT45_BUFFER1 : AT45_BUFFER2;
+        _at45_buffer = !_at45_buffer;
+        AT45DBCore::at45_buffer_writev(buf, 0, seg, count);
+        return AT45DBCore::at45_buffer_program(buf, addr, false);
+    }
+#endif  // AT45_TRACK_ERASED
+
+    // load buffer code and toggle buffer
+    AT45DBCore::at45_command(opcode, _at45_buffer ? AT45_PAGE_WRITE_BUF1 : AT45_PAGE_WRITE_BUF2, addr);
+    AT45DBCore::at45_buffer_holds(_at45_buffer ? AT45_BUFFER1 : AT45_BUFFER2, addr);
+    _at45_buffer = !_at45_buffer;
+    // now send data the chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    for (i=0; i<count; i++) {
+        AT45DBCore::at45_transfer(seg[i].buff, seg[i].size, NULL, 0);
+    }
+    AT45DBCore::at45_deselect();
+    AT45DBCore::at45_mark_page(addr, false);
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_writebuffer(uint32_t addr, const uint8_t *buff, uint32_t size)
+{
+    return AT45DBCore::at45_buffer_write(_g_at45_buffer ? AT45_BUFFER1 : AT45_BUFFER2, addr, buff, size);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_buffer2memory(uint32_t addr)
+{
+    BUFFERS     buf = _g_at45_buffer ? AT45_BUFFER1 : AT45_BUFFER2;
+
+    _g_at45_buffer = !_g_at45_buffer;
+    return AT45DBCore::at45_buffer_program(buf, addr);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_buffer_write(BUFFERS buf, uint32_t offset, const uint8_t *buff, uint32_t size)
+{
+    at45_const_segment  seg = {buff, size};
+
+    return AT45DBCore::at45_buffer_writev(buf, offset, &seg, 1);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_buffer_writev(BUFFERS buf, uint32_t offset, const at45_const_segment *seg, uint32_t count)
+{
+    uint8_t     opcode[4];
+    uint32_t    i;
+
+    AT45DBCore::at45_command(opcode, (buf == AT45_BUFFER1) ? AT45_BUFFER_WRITE_BUF1 : AT45_BUFFER_WRITE_BUF2, offset);
+    // the buffer no longer matches any page until it is programmed
+    AT45DBCore::at45_buffer_holds(buf, AT45_NO_PAGE);
+    // now send data the chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    for (i=0; i<count; i++) {
+        AT45DBCore::at45_transfer(seg[i].buff, seg[i].size, NULL, 0);
+    }
+    AT45DBCore::at45_deselect();
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_readbuffer(BUFFERS buf, uint32_t offset, uint8_t *buff, uint32_t size)
+{
+    at45_segment    seg = {buff, size};
+
+    return AT45DBCore::at45_readbufferv(buf, offset, &seg, 1);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_readbufferv(BUFFERS buf, uint32_t offset, const at45_segment *seg, uint32_t count)
+{
+    uint8_t     opcode[5];
+    uint8_t     cmd;
+    uint32_t    i;
+
+    if (_at45_bufrd_lf) {
+        cmd = (buf == AT45_BUFFER1) ? AT45_BUF1_READ_LF : AT45_BUF2_READ_LF;
+    } else {
+        cmd = (buf == AT45_BUFFER1) ? AT45_BUF1_READ_SER : AT45_BUF2_READ_SER;
+    }
+    AT45DBCore::at45_command(opcode, cmd, offset);
+    opcode[4] = DUMMY;
+    // now send command to chip and read back data
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, _at45_bufrd_lf ? 4 : 5, NULL, 0);
+    for (i=0; i<count; i++) {
+        AT45DBCore::at45_transfer(NULL, 0, seg[i].buff, seg[i].size);
+    }
+    AT45DBCore::at45_deselect();
+    return 1;
+}
+
+template <class Bus>
+uint32_t AT45DBCore<Bus>::at45_buffer_page(BUFFERS buf)
+{
+    return _at45_bufpage[buf];
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_buffer_program(BUFFERS buf, uint32_t addr, bool erase)
+{
+    uint8_t     opcode[4];
+    uint8_t     cmd;
+
+    if (erase) {
+        cmd = (buf == AT45_BUFFER1) ? AT45_BUFFER_TO_MAIN_MEMORY_BUF1 : AT45_BUFFER_TO_MAIN_MEMORY_BUF2;
+    } else {
+        cmd = (buf == AT45_BUFFER1) ? AT45_BUF1_MEM_NOERASE : AT45_BUF2_MEM_NOERASE;
+    }
+    AT45DBCore::at45_command(opcode, cmd, addr);
+    // without erase the page only matches the buffer if it was erased
+    if (erase || AT45DBCore::at45_known_erased(addr)) {
+        AT45DBCore::at45_buffer_holds(buf, addr);
+    } else if (AT45DBCore::at45_buffer_find(addr) >= 0) {
+        AT45DBCore::at45_buffer_holds((BUFFERS)AT45DBCore::at45_buffer_find(addr), AT45_NO_PAGE);
+    }
+    // send command to chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    AT45DBCore::at45_deselect();
+    AT45DBCore::at45_mark_page(addr, false);
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_page2buffer(BUFFERS buf, uint32_t addr)
+{
+    uint8_t     opcode[4];
+
+    AT45DBCore::at45_command(opcode, (buf == AT45_BUFFER1) ? AT45_PAGE_BUF1_TX : AT45_PAGE_BUF2_TX, addr);
+    // send command to chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    AT45DBCore::at45_deselect();
+    _at45_bufpage[buf] = addr - (addr % AT45DBCore::at45_page_size());
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_page_compare(BUFFERS buf, uint32_t addr)
+{
+    uint8_t     opcode[4];
+
+    AT45DBCore::at45_command(opcode, (buf == AT45_BUFFER1) ? AT45_PAGE_BUF1_CMP : AT45_PAGE_BUF2_CMP, addr);
+    // send command to chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    AT45DBCore::at45_deselect();
+    return 1;
+}
+
+template <class Bus>
+void AT45DBCore<Bus>::at45_set_write_elision(bool enable)
+{
+    _at45_elide = enable;
+}
+
+template <class Bus>
+uint32_t AT45DBCore<Bus>::at45_get_elided_writes(void)
+{
+    return _at45_elided;
+}
+
+template <class Bus>
+uint32_t AT45DBCore<Bus>::at45_get_compared_writes(void)
+{
+    return _at45_compared;
+}
+
+/*
+ * Per page: 53h/55h (4 bytes), 84h/87h (4 bytes + data), 83h/86h or 
+ * 88h/89h (4 bytes). The device must be idle before each page transfer;
+ * the final program is left running, as with at45_writepage. The EP bit
+ * stays set until the next erase or program, so before the first page 
+ * it belongs to some earlier operation and only a timeout fails; after
+ * that it is the result of this call's own program.
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_update(uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    uint32_t    page, offset, n;
+    BUFFERS     buf;
+    bool        own = false;
+    int         rc;
+
+    while (len > 0) {
+        offset = addr % AT45DBCore::at45_page_size();
+        page = addr - offset;
+        n = AT45DBCore::at45_page_size() - offset;
+        if (n > len) {
+            n = len;
+        }
+        buf = _at45_buffer ? AT45_BUFFER1 : AT45_BUFFER2;
+        _at45_buffer = !_at45_buffer;
+
+        rc = AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, AT45_OP_ERASE_PROGRAM);
+        if ((rc == AT45_ERR_TIMEOUT) || (own && (rc != AT45_OK))) {
+            return 0;
+        }
+        AT45DBCore::at45_page2buffer(buf, page);
+        if (AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, AT45_OP_TRANSFER) != AT45_OK) {
+            return 0;
+        }
+        AT45DBCore::at45_buffer_write(buf, offset, data, n);
+        AT45DBCore::at45_buffer_program(buf, page, !AT45DBCore::at45_known_erased(page));
+        own = true;
+
+        addr += n;
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/*
+ * Pages start out unknown and are read once to find out whether they
+ * are erased; after that the map follows every erase and program.
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_is_page_erased(uint32_t addr)
+{
+#if AT45_TRACK_ERASED
+    uint32_t    page = (addr / AT45DBCore::at45_page_size()) % AT45DBCore::at45_page_count();
+    uint8_t     mask = 1 << (page & 7);
+
+    if (!(_at45_known[page >> 3] & mask)) {
+        AT45DBCore::at45_mark_page(addr, AT45DBCore::at45_probe_erased(addr));
+    }
+    return (_at45_erased[page >> 3] & mask) != 0;
+#else
+    return AT45DBCore::at45_probe_erased(addr);
+#endif  // AT45_TRACK_ERASED
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_erasepage(uint32_t addr)
+{
+    uint8_t     opcode[4];
+
+    AT45DBCore::at45_command(opcode, AT45_PAGE_ERASE, addr);
+    // send command to chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    AT45DBCore::at45_deselect();
+    AT45DBCore::at45_mark_erasing(addr, 1);
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_eraseblock(uint32_t addr)
+{
+    uint8_t     opcode[4];
+    uint32_t    blk_pages = AT45DBCore::at45_block_pages();
+
+    AT45DBCore::at45_command(opcode, AT45_BLOCK_ERASE, addr);
+    // send command to chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    AT45DBCore::at45_deselect();
+    AT45DBCore::at45_mark_erasing(addr & ~(uint32_t)(blk_pages * AT45DBCore::at45_page_size() - 1), blk_pages);
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_erasesector(uint32_t addr)
+{
+    uint8_t     opcode[4];
+    uint32_t    page_size = AT45DBCore::at45_page_size();
+    uint32_t    blk_pages = AT45DBCore::at45_block_pages();
+    uint32_t    sec_pages = AT45DBCore::at45_sector_pages();
+    uint32_t    page = (addr / page_size) % AT45DBCore::at45_page_count();
+
+    AT45DBCore::at45_command(opcode, AT45_SECTOR_ERASE, addr);
+    // send command to chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    AT45DBCore::at45_deselect();
+    if (page < blk_pages) {
+        AT45DBCore::at45_mark_erasing(0, blk_pages);                                    // sector 0a
+    } else if (page < sec_pages) {
+        AT45DBCore::at45_mark_erasing(blk_pages * page_size, sec_pages - blk_pages);    // sector 0b
+    } else {
+        AT45DBCore::at45_mark_erasing((page & ~(sec_pages - 1)) * page_size, sec_pages);
+    }
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_erasechip(void)
+{
+    uint8_t     devcmd[] = {AT45_CHIP_ERASE_FIRST, AT45_CHIP_ERASE};
+
+    // send command to chip
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(devcmd, sizeof(devcmd), NULL, 0);
+    AT45DBCore::at45_deselect();
+    AT45DBCore::at45_mark_erasing(0, AT45DBCore::at45_page_count());
+    return 1;
+}
+
+template <class Bus>
+uint32_t AT45DBCore<Bus>::at45_erase_estimate(uint32_t addr, uint32_t len)
+{
+    uint32_t    page_size = AT45DBCore::at45_page_size();
+
+    if ((addr % page_size) || (len % page_size) || 
+        ((addr + len) > (AT45DBCore::at45_page_count() * page_size))) {
+        return 0;
+    }
+    return (AT45DBCore::at45_erase_plan(addr / page_size, len / page_size, false, NULL) + 999) / 1000;
+}
+
+template <class Bus>
+int AT45DBCore<Bus>::at45_erase_range(uint32_t addr, uint32_t len)
+{
+    uint32_t    page_size = AT45DBCore::at45_page_size();
+    int         result = AT45_OK;
+
+    if ((addr % page_size) || (len % page_size) || 
+        ((addr + len) > (AT45DBCore::at45_page_count() * page_size))) {
+        return AT45_ERR_PARAM;
+    }
+    AT45DBCore::at45_erase_plan(addr / page_size, len / page_size, true, &result);
+    return result;
+}
+
+/*
+ * In ultra deep power down mode it consumes less than 1uA.
+ * In ultra deep power down mode, all commands including the 
+ * Status Register Read and Resume from Deep Power-Down commands
+ * will be ignored.
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_ultra_deep_pwrdown_enter(void)
+{
+    uint8_t     opcode[4];
+
+    if (!AT45DBCore::at45_has(AT45_CAP_UDPD)) {
+        return 0;
+    }
+    opcode [0] = AT45_ULTRA_DEEP_PDOWN;
+    // the RAM buffers do not survive ultra deep power down
+    _at45_bufpage[AT45_BUFFER1] = _at45_bufpage[AT45_BUFFER2] = AT45_NO_PAGE;
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 1, NULL, 0);
+    AT45DBCore::at45_deselect();
+    return 1;
+}
+
+/* 
+ * exit from ultra deep power down mode by 
+ * asserting CS pin for more than 20ns, 
+ * deasserting the CS then wait for 120us.
+ * the RAM buffers are undefined after wake from deep power down
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_ultra_deep_pwrdown_exit(void)
+{
+    if (!AT45DBCore::at45_has(AT45_CAP_UDPD)) {
+        return 0;
+    }
+    _bus.select();
+    _bus.wait_us(1);            // 1us
+    _bus.deselect();
+    _bus.sleep_ms(1);           // 1ms
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_is_ready(void)
+{
+    uint16_t status = AT45DBCore::at45_get_status();
+    return AT45_STATUS_READY(status);
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_is_ep_failed(void)
+{
+    uint16_t status = AT45DBCore::at45_get_status();
+    return AT45_STATUS_EP_ERROR(status);
+}
+
+
+/*
+ * The status register is output continuously (byte1, byte2, byte1, ...)
+ * for as long as CS stays asserted after D7h, so short waits poll in one
+ * command frame and just yield between samples. Longer waits sleep, and
+ * deselect (releasing the SPI lock) for the sleep, so that a chip erase
+ * does not hold the bus for seconds.
+ */
+template <class Bus>
+int AT45DBCore<Bus>::at45_wait_ready(uint32_t timeout_ms, OPERATIONS op, uint16_t *status)
+{
+    uint8_t     opcode = AT45_STATUS_READ;
+    uint8_t     data[2];
+    uint16_t    value;
+    uint32_t    typ_ms = AT45DBCore::at45_op_us(op, false) / 1000;
+    uint32_t    delay_ms;
+    int         result = AT45_OK;
+    bool        first = true;
+    uint32_t    start;
+#if AT45_STATS
+    uint32_t    start_us = _bus.now_us();
+#endif  // AT45_STATS
+
+    if (timeout_ms == AT45_WAIT_DEFAULT) {
+        timeout_ms = ((2 * AT45DBCore::at45_op_us(op, true)) + 999) / 1000;
+    }
+    // if still busy, the next sample is after most of the typical time
+    delay_ms = (typ_ms * 3) / 4;
+    
+    start = _bus.now_ms();
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(&opcode, 1, NULL, 0);
+    for (;;) {
+        AT45DBCore::at45_transfer(NULL, 0, data, 2);
+        if (!AT45DBCore::at45_has(AT45_CAP_STATUS2)) {
+            data[1] = 0;        // byte1 again
+        }
+        value = (uint16_t)((data[0] << 8) | data[1]);
+        if (AT45_STATUS_READY(value)) {
+            break;
+        }
+        // the clock ticks in ms: a full timeout_ms has only passed once it has moved on by more
+        if ((uint32_t)(_bus.now_ms() - start) > timeout_ms) {
+            result = AT45_ERR_TIMEOUT;
+            break;
+        }
+        if (delay_ms > 0) {
+            // let go of the bus while asleep; D7h is sent again after
+            AT45DBCore::at45_deselect();
+            _bus.sleep_ms(delay_ms);
+            AT45DBCore::at45_select();
+            AT45DBCore::at45_transfer(&opcode, 1, NULL, 0);
+        } else {
+            _bus.yield();
+        }
+        // back off from an eighth of the typical time, doubling up to a half
+        if (first) {
+            delay_ms = typ_ms / 8;
+            first = false;
+        } else if (delay_ms < typ_ms / 4) {
+            delay_ms *= 2;
+        } else {
+            delay_ms = typ_ms / 2;
+        }
+    }
+    AT45DBCore::at45_deselect();
+
+    if ((result == AT45_OK) && (op != AT45_OP_TRANSFER) && AT45_STATUS_EP_ERROR(value)) {
+        result = AT45_ERR_EP;
+    }
+    AT45DBCore::at45_erase_done((result != AT45_ERR_TIMEOUT) && !AT45_STATUS_EP_ERROR(value));
+#if AT45_STATS
+    _at45_stats.wait_us += (uint32_t)(_bus.now_us() - start_us);
+    _at45_stats.waits++;
+    if (result == AT45_ERR_TIMEOUT) {
+        _at45_stats.timeouts++;
+    } else if (result == AT45_ERR_EP) {
+        _at45_stats.ep_failures++;
+    }
+#endif  // AT45_STATS
+    if (status != NULL) {
+        *status = value;
+    }
+    return result;
+}
+
+#if AT45_STATS
+template <class Bus>
+const at45_stats &AT45DBCore<Bus>::at45_get_stats(void)
+{
+    _at45_stats.spi_us = (_at45_stats.bytes * 8 * 1000000) / _at45_freq;
+    return _at45_stats;
+}
+
+template <class Bus>
+void AT45DBCore<Bus>::at45_reset_stats(void)
+{
+    memset(&_at45_stats, 0, sizeof(_at45_stats));
+}
+#endif  // AT45_STATS
+
+#if DEVICE_SPI_ASYNCH
+template <class Bus>
+bool AT45DBCore<Bus>::at45_readpage_async(uint32_t addr, uint8_t *buff, uint32_t size, Callback<void(int)> done)
+{
+    uint8_t     opcode[8];
+
+    if (core_util_atomic_flag_test_and_set(&_at45_async_claim)) {
+        return 0;
+    }
+    _at45_async_write = false;
+    _at45_async_done = done;
+    
+    AT45DBCore::at45_command(opcode, AT45_PAGE_READ, addr);
+    opcode[4] = opcode[5] = opcode[6] = opcode[7] = DUMMY;
+    // header now, payload in the background; CS is released on completion
+    _bus.lock();
+    _bus.cs_low();
+#if AT45_STATS
+    _at45_stat_cmd = true;
+    _at45_stats.bytes += size;
+#endif  // AT45_STATS
+    AT45DBCore::at45_transfer(opcode, 8, NULL, 0);
+    _at45_async_state = AT45_ASYNC_TRANSFER;
+    _bus.transfer_async(NULL, 0, buff, size, callback(this, &AT45DBCore::at45_async_complete));
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_writepage_async(uint32_t addr, const uint8_t *buff, uint32_t size, Callback<void(int)> done)
+{
+    uint8_t     opcode[4];
+
+    if (core_util_atomic_flag_test_and_set(&_at45_async_claim)) {
+        return 0;
+    }
+    _at45_async_write = true;
+    _at45_async_done = done;
+
+    // load buffer code and toggle buffer
+    AT45DBCore::at45_command(opcode, _at45_buffer ? AT45_PAGE_WRITE_BUF1 : AT45_PAGE_WRITE_BUF2, addr);
+    AT45DBCore::at45_buffer_holds(_at45_buffer ? AT45_BUFFER1 : AT45_BUFFER2, addr);
+    _at45_buffer = !_at45_buffer;
+    AT45DBCore::at45_mark_page(addr, false);
+    // header now, payload in the background; CS is released on completion
+    _bus.lock();
+    _bus.cs_low();
+#if AT45_STATS
+    _at45_stat_cmd = true;
+    _at45_stats.bytes += size;
+#endif  // AT45_STATS
+    AT45DBCore::at45_transfer(opcode, 4, NULL, 0);
+    _at45_async_state = AT45_ASYNC_TRANSFER;
+    _bus.transfer_async(buff, size, NULL, 0, callback(this, &AT45DBCore::at45_async_complete));
+    return 1;
+}
+
+template <class Bus>
+bool AT45DBCore<Bus>::at45_async_busy(void)
+{
+    return _at45_async_state != AT45_ASYNC_IDLE;
+}
+
+/*
+ * Interrupt context: release CS (which starts programming on a write)
+ * and tell the caller. The bus lock belongs to the thread that started
+ * the operation, so it is released by at45_async_poll.
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_async_complete(int event)
+{
+    _bus.cs_high();
+    _at45_async_event = event;
+    _at45_async_state = AT45_ASYNC_DONE;
+    if (_at45_async_done) {
+        _at45_async_done(event);
+    }
+}
+
+/*
+ * Thread context: release the bus once the transfer is over, then on
+ * a write sample the status until the page program has completed.
+ */
+template <class Bus>
+int AT45DBCore<Bus>::at45_async_poll(void)
+{
+    int         result = AT45_OK;
+    uint16_t    status;
+
+    switch (_at45_async_state) {
+    case AT45_ASYNC_IDLE:
+        return AT45_OK;
+    case AT45_ASYNC_TRANSFER:
+        return AT45_BUSY;
+    case AT45_ASYNC_DONE:
+        _bus.unlock();
+        if (_at45_async_event & SPI_EVENT_ERROR) {
+            result = AT45_ERR_BUS;
+            break;
+        }
+        if (!_at45_async_write) {
+            break;
+        }
+        _at45_async_state = AT45_ASYNC_PROGRAM;
+        // fall through
+    case AT45_ASYNC_PROGRAM:
+        status = AT45DBCore::at45_get_status();
+        if (!AT45_STATUS_READY(status)) {
+            return AT45_BUSY;
+        }
+        if (AT45_STATUS_EP_ERROR(status)) {
+            result = AT45_ERR_EP;
+#if AT45_STATS
+            _at45_stats.ep_failures++;
+#endif  // AT45_STATS
+        }
+        break;
+    }
+    _at45_async_state = AT45_ASYNC_IDLE;
+    core_util_atomic_flag_clear(&_at45_async_claim);
+    return result;
+}
+#endif  // DEVICE_SPI_ASYNCH
+
+/*
+ * Pick the continuous read opcode with the fewest dummy bytes that is
+ * valid at 'freq'. The low power opcode is only taken when asked for,
+ * and only on parts that have it; at equal cost the fast preference 
+ * uses the low frequency opcode. The legacy opcode is never cheaper 
+ * but keeps the table complete.
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_select_read_opcode(READMODES mode, uint32_t freq)
+{
+    uint32_t    i;
+    int         best = -1;
+
+    for (i=0; i<sizeof(at45_read_opcodes)/sizeof(at45_read_opcodes[0]); i++) {
+        if (freq > at45_read_opcodes[i].max_freq) {
+            continue;
+        }
+        if (((mode != AT45_READ_LOW_POWER) || !AT45DBCore::at45_has(AT45_CAP_READ_LP)) && 
+            (at45_read_opcodes[i].opcode == AT45_CONTINUOUS_READ_LP)) {
+            continue;
+        }
+        if ((best < 0) || (at45_read_opcodes[i].dummy < at45_read_opcodes[best].dummy)) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        best = 2;           // 0Bh is valid at the highest clock
+    }
+    _at45_rdop[mode] = at45_read_opcodes[best].opcode;
+    _at45_rddummy[mode] = at45_read_opcodes[best].dummy;
+}
+
+/*
+ * Typical or maximum duration of an operation on the part in use. The
+ * table is for the AT45DB161E: sector and chip erase are scaled by the
+ * size erased, the per page operations are taken as they are.
+ */
+template <class Bus>
+uint32_t AT45DBCore<Bus>::at45_op_us(OPERATIONS op, bool max)
+{
+    uint64_t    us = max ? at45_op_times[op].max_us : at45_op_times[op].typ_us;
+    uint64_t    page_size = AT45DBCore::at45_page_size();
+
+    if (op == AT45_OP_SECTOR_ERASE) {
+        us = (us * AT45DBCore::at45_sector_pages() * page_size) / (256 * 512);
+    } else if (op == AT45_OP_CHIP_ERASE) {
+        us = (us * AT45DBCore::at45_page_count() * page_size) / (4096 * 512);
+    }
+    return (uint32_t)us;
+}
+
+/*
+ * Assert CS and hold the SPI bus for the duration of a command
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_select(void)
+{
+    _bus.select();
+#if AT45_STATS
+    _at45_stat_cmd = true;
+#endif  // AT45_STATS
+}
+
+/*
+ * Release CS and the SPI bus; a low-to-high CS transition 
+ * starts any internally timed operation
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_deselect(void)
+{
+    _bus.deselect();
+}
+
+/*
+ * Block transfer: the bus clocks the whole run in one call rather
+ * than one call per byte. When rx_len > tx_len the remaining bytes 
+ * are clocked out as DUMMY. The first transfer after CS is asserted
+ * carries the opcode.
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_transfer(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len)
+{
+#if AT45_STATS
+    if (_at45_stat_cmd && (tx_len > 0)) {
+        _at45_stats.commands[tx[0]]++;
+        _at45_stat_cmd = false;
+    }
+    _at45_stats.bytes += (tx_len > rx_len) ? tx_len : rx_len;
+#endif  // AT45_STATS
+    _bus.transfer(tx, tx_len, rx, rx_len);
+}
+
+/*
+ * Fill in opcode followed by the 3-byte address, MSB first
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_command(uint8_t *opcode, uint8_t cmd, uint32_t addr)
+{
+    opcode[0] = cmd;
+    opcode[1] = (uint8_t)((addr >> 16) & 0xff);
+    opcode[2] = (uint8_t)((addr >> 8) & 0xff);
+    opcode[3] = (uint8_t)(addr & 0xff);
+}
+
+template <class Bus>
+void AT45DBCore<Bus>::at45_mark_page(uint32_t addr, bool erased)
+{
+    int         buf;
+
+    // a buffer copy of an erased page is stale
+    if (erased && ((buf = AT45DBCore::at45_buffer_find(addr)) >= 0)) {
+        _at45_bufpage[buf] = AT45_NO_PAGE;
+    }
+#if AT45_TRACK_ERASED
+    uint32_t    page = (addr / AT45DBCore::at45_page_size()) % AT45DBCore::at45_page_count();
+    uint8_t     mask = 1 << (page & 7);
+
+    _at45_known[page >> 3] |= mask;
+    if (erased) {
+        _at45_erased[page >> 3] |= mask;
+    } else {
+        _at45_erased[page >> 3] &= ~mask;
+    }
+#endif  // AT45_TRACK_ERASED
+}
+
+/*
+ * Erased according to the map, without reading the page if unknown
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_known_erased(uint32_t addr)
+{
+#if AT45_TRACK_ERASED
+    uint32_t    page = (addr / AT45DBCore::at45_page_size()) % AT45DBCore::at45_page_count();
+    uint8_t     mask = 1 << (page & 7);
+
+    return (_at45_known[page >> 3] & _at45_erased[page >> 3] & mask) != 0;
+#else
+    (void)addr;
+    return 0;
+#endif  // AT45_TRACK_ERASED
+}
+
+/*
+ * Read the page in short runs within one CS assertion and stop at 
+ * the first byte that is not FFh. The device must be idle to read
+ * the array, so any operation still in progress is waited out first.
+ */
+template <class Bus>
+bool AT45DBCore<Bus>::at45_probe_erased(uint32_t addr)
+{
+    uint8_t     opcode[8];
+    uint8_t     data[32];
+    uint32_t    done, i;
+    bool        erased = true;
+
+    if (AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, AT45_OP_ERASE_PROGRAM) == AT45_ERR_TIMEOUT) {
+        return 0;
+    }
+    addr &= ~(uint32_t)(AT45DBCore::at45_page_size() - 1);
+    AT45DBCore::at45_command(opcode, _at45_rdop[AT45_READ_FAST], addr);
+    opcode[4] = opcode[5] = opcode[6] = opcode[7] = DUMMY;
+    AT45DBCore::at45_select();
+    AT45DBCore::at45_transfer(opcode, 4 + _at45_rddummy[AT45_READ_FAST], NULL, 0);
+    for (done=0; erased && (done<AT45DBCore::at45_page_size()); done+=sizeof(data)) {
+        AT45DBCore::at45_transfer(NULL, 0, data, sizeof(data));
+        for (i=0; i<sizeof(data); i++) {
+            if (data[i] != 0xff) {
+                erased = false;
+                break;
+            }
+        }
+    }
+    AT45DBCore::at45_deselect();
+    return erased;
+}
+
+template <class Bus>
+void AT45DBCore<Bus>::at45_mark_pages(uint32_t addr, uint32_t count, bool erased)
+{
+    while (count--) {
+        AT45DBCore::at45_mark_page(addr, erased);
+        addr += AT45DBCore::at45_page_size();
+    }
+}
+
+template <class Bus>
+void AT45DBCore<Bus>::at45_mark_erasing(uint32_t addr, uint32_t count)
+{
+    AT45DBCore::at45_mark_pages(addr, count, true);
+#if AT45_TRACK_ERASED
+    _at45_erasing = (addr / AT45DBCore::at45_page_size()) % AT45DBCore::at45_page_count();
+    _at45_erasing_count = count;
+#endif  // AT45_TRACK_ERASED
+}
+
+/*
+ * The status after an erase is that erase's own result (the EP bit is
+ * reset by each erase or program), so the pages are only left marked
+ * erased if it completed without error.
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_erase_done(bool ok)
+{
+#if AT45_TRACK_ERASED
+    uint32_t    page;
+
+    if (!ok) {
+        for (page=_at45_erasing; page<_at45_erasing+_at45_erasing_count; page++) {
+            _at45_known[page >> 3] &= ~(1 << (page & 7));
+            _at45_erased[page >> 3] &= ~(1 << (page & 7));
+        }
+    }
+    _at45_erasing_count = 0;
+#else
+    (void)ok;
+#endif  // AT45_TRACK_ERASED
+}
+
+/*
+ * Erase units nest (page < block < sector < chip), so taking the larger 
+ * unit wherever it is aligned, fits in the range and is no slower than 
+ * covering the same pages with the next smaller unit gives the fastest
+ * plan, and among equally fast plans the one with fewest commands.
+ * Sector 0 is split into 0a (block 0) and 0b (the rest of sector 0).
+ */
+template <class Bus>
+uint32_t AT45DBCore<Bus>::at45_erase_plan(uint32_t page, uint32_t count, bool execute, int *result)
+{
+    uint32_t    t_page = AT45DBCore::at45_op_us(AT45_OP_PAGE_ERASE, false);
+    uint32_t    t_block_op = AT45DBCore::at45_op_us(AT45_OP_BLOCK_ERASE, false);
+    uint32_t    t_sector_op = AT45DBCore::at45_op_us(AT45_OP_SECTOR_ERASE, false);
+    uint32_t    t_block = t_block_op;
+    uint32_t    t_sector = t_sector_op;
+    uint32_t    t_chip = AT45DBCore::at45_op_us(AT45_OP_CHIP_ERASE, false);
+    uint32_t    blk_pages = AT45DBCore::at45_block_pages();
+    uint32_t    sec_pages = AT45DBCore::at45_sector_pages();
+    uint32_t    page_count = AT45DBCore::at45_page_count();
+    uint32_t    end = page + count;
+    uint32_t    total = 0;
+    uint32_t    first, pages, cost;
+    OPERATIONS  op;
+    int         rc;
+
+    // best cost of covering a block, a sector and the chip with smaller units
+    if (t_block > blk_pages * t_page) {
+        t_block = blk_pages * t_page;
+    }
+    if (t_sector > (sec_pages / blk_pages) * t_block) {
+        t_sector = (sec_pages / blk_pages) * t_block;
+    }
+
+    if ((page == 0) && (count == page_count) && 
+        (t_chip <= (page_count / sec_pages) * t_sector)) {
+        if (execute) {
+            AT45DBCore::at45_erasechip();
+            rc = AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, AT45_OP_CHIP_ERASE);
+            if ((rc != AT45_OK) && (result != NULL)) {
+                *result = rc;
+            }
+        }
+        return t_chip;
+    }
+
+    while (page < end) {
+        // sector containing this page
+        if (page < blk_pages) {
+            first = 0;
+            pages = blk_pages;
+        } else if (page < sec_pages) {
+            first = blk_pages;
+            pages = sec_pages - blk_pages;
+        } else {
+            first = page & ~(sec_pages - 1);
+            pages = sec_pages;
+        }
+        cost = (pages / blk_pages) * t_block;
+        if ((page == first) && ((page + pages) <= end) && (pages > blk_pages) &&
+            (t_sector_op <= cost)) {
+            op = AT45_OP_SECTOR_ERASE;
+            cost = t_sector_op;
+        } else if (!(page % blk_pages) && ((page + blk_pages) <= end) &&
+                   (t_block_op <= blk_pages * t_page)) {
+            op = AT45_OP_BLOCK_ERASE;
+            pages = blk_pages;
+            cost = t_block_op;
+        } else {
+            op = AT45_OP_PAGE_ERASE;
+            pages = 1;
+            cost = t_page;
+        }
+        if (execute) {
+            if (op == AT45_OP_SECTOR_ERASE) {
+                AT45DBCore::at45_erasesector(page * AT45DBCore::at45_page_size());
+            } else if (op == AT45_OP_BLOCK_ERASE) {
+                AT45DBCore::at45_eraseblock(page * AT45DBCore::at45_page_size());
+            } else {
+                AT45DBCore::at45_erasepage(page * AT45DBCore::at45_page_size());
+            }
+            rc = AT45DBCore::at45_wait_ready(AT45_WAIT_DEFAULT, op);
+            if (rc != AT45_OK) {
+                if (result != NULL) {
+                    *result = rc;
+                }
+                break;
+            }
+        }
+        total += cost;
+        page += pages;
+    }
+    return total;
+}
+
+/*
+ * Programming a buffer into a page makes any copy of that page in the 
+ * other buffer stale, so it is dropped.
+ */
+template <class Bus>
+void AT45DBCore<Bus>::at45_buffer_holds(BUFFERS buf, uint32_t addr)
+{
+    if (addr != AT45_NO_PAGE) {
+        addr -= addr % AT45DBCore::at45_page_size();
+        if (_at45_bufpage[!buf] == addr) {
+            _at45_bufpage[!buf] = AT45_NO_PAGE;
+        }
+    }
+    _at45_bufpage[buf] = addr;
+}
+
+template <class Bus>
+int AT45DBCore<Bus>::at45_buffer_find(uint32_t addr)
+{
+    addr -= addr % AT45DBCore::at45_page_size();
+    if (_at45_bufpage[AT45_BUFFER1] == addr) {
+        return AT45_BUFFER1;
+    }
+    if (_at45_bufpage[AT45_BUFFER2] == addr) {
+        return AT45_BUFFER2;
+    }
+    return -1;
+}
+
+#endif // _AT45DBCORE_IMPL_H_
@@ -0,0 +1,54 @@
+/* 
+ * @file    AT45DBCrc.h
+ * @brief   CRC-16 for records stored on the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBCRC_H_
+#define _AT45DBCRC_H_
+
+#include <stdint.h>
+
+#define AT45_CRC_INIT       0xffff              // CRC-16/CCITT-FALSE initial value
+
+/*
+ * CRC-16/CCITT (polynomial 1021h), computed a nibble at a time from a 
+ * 16 entry table. Pass the result of one call as 'crc' to the next to 
+ * cover data in several pieces.
+ *
+ * @param *data = pointer to the data
+ * @param len = number of bytes
+ * @param crc = AT45_CRC_INIT, or the CRC of the preceding data
+ * @return CRC of the data
+ */
+static inline uint16_t at45_crc16(const uint8_t *data, uint32_t len, uint16_t crc = AT45_CRC_INIT)
+{
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    };
+
+    while (len--) {
+        crc = (uint16_t)((crc << 4) ^ table[(crc >> 12) ^ (*data >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ table[(crc >> 12) ^ (*data & 0x0f)]);
+        data++;
+    }
+    return crc;
+}
+
+#endif // _AT45DBCRC_H_
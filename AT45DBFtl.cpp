@@ -0,0 +1,485 @@
+/* 
+ * @file    AT45DBFtl.cpp
+ * @brief   Wear-levelling flash translation layer for the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBFtl.h"
+
+AT45DBFtl::AT45DBFtl(AT45DB &flash, uint32_t addr, uint32_t blocks) :
+        _flash(flash), _addr(addr), _blocks(blocks), _pages(0), _seq(0), _free(0), 
+        _victim(AT45_FTL_NONE), _gc_page(0), _buffer(AT45DB::AT45_BUFFER1), _busy(false)
+{
+    uint32_t    spare = blocks / AT45_FTL_SPARE;
+
+    if (spare < 4) {
+        spare = 4;
+    }
+    if (blocks > spare) {
+        _pages = (blocks - spare) * AT45_FTL_BLOCK_PAGES;
+    }
+    _open[STREAM_HOT] = _open[STREAM_COLD] = AT45_FTL_NONE;
+    _next[STREAM_HOT] = _next[STREAM_COLD] = 0;
+    memset(_erases, 0, sizeof(_erases));
+}
+
+AT45DBFtl::~AT45DBFtl() { }
+
+/*
+ * Every page header is read once. Where a logical page has several
+ * copies (the old ones are never cleared), the highest sequence number 
+ * wins. Blocks erased but not yet written carry no erase count; they
+ * are given the average of the others.
+ */
+bool AT45DBFtl::mount(void)
+{
+    page_header     hdr, old;
+    uint32_t        b, i, page, prev;
+    uint32_t        known = 0;
+    uint64_t        sum = 0;
+    bool            used;
+
+    if ((_blocks > AT45_FTL_BLOCKS) || (_pages == 0) || 
+        (_flash.at45_block_pages() != AT45_FTL_BLOCK_PAGES)) {
+        return 0;
+    }
+    AT45DBFtl::wait_programmed();
+    memset(_valid_count, 0, sizeof(_valid_count));
+    memset(_mapped, 0, sizeof(_mapped));
+    memset(_hot, 0, sizeof(_hot));
+    memset(_valid, 0, sizeof(_valid));
+    _seq = 0;
+    _free = 0;
+    _open[STREAM_HOT] = _open[STREAM_COLD] = AT45_FTL_NONE;
+    _victim = AT45_FTL_NONE;
+
+    for (b=0; b<_blocks; b++) {
+        _erases[b] = AT45_FTL_NONE;
+        used = false;
+        for (i=0; i<AT45_FTL_BLOCK_PAGES; i++) {
+            page = b * AT45_FTL_BLOCK_PAGES + i;
+            if (!AT45DBFtl::read_header(page, &hdr)) {
+                // erased, or torn by a power failure during the program
+                used |= (hdr.seq != AT45_FTL_NONE);
+                continue;
+            }
+            used = true;
+            if ((_erases[b] == AT45_FTL_NONE) || (hdr.erases > _erases[b])) {
+                _erases[b] = hdr.erases;
+            }
+            if (hdr.seq >= _seq) {
+                _seq = hdr.seq + 1;
+            }
+            if (hdr.lpn >= _pages) {
+                continue;
+            }
+            if (AT45DBFtl::bit_get(_mapped, hdr.lpn)) {
+                prev = AT45DBFtl::map_get(hdr.lpn);
+                AT45DBFtl::read_header(prev, &old);
+                if (old.seq > hdr.seq) {
+                    continue;
+                }
+                AT45DBFtl::bit_set(_valid, prev, false);
+                _valid_count[prev / AT45_FTL_BLOCK_PAGES]--;
+            }
+            AT45DBFtl::place(hdr.lpn, page);
+        }
+        if (_erases[b] != AT45_FTL_NONE) {
+            sum += _erases[b];
+            known++;
+        }
+        if (used) {
+            _state[b] = BLOCK_USED;
+        } else {
+            _state[b] = BLOCK_FREE;
+            _free++;
+        }
+    }
+    for (b=0; b<_blocks; b++) {
+        if (_erases[b] == AT45_FTL_NONE) {
+            _erases[b] = known ? (uint32_t)(sum / known) : 0;
+        }
+    }
+    return 1;
+}
+
+bool AT45DBFtl::format(void)
+{
+    uint32_t    b;
+
+    if (!AT45DBFtl::wait_programmed()) {
+        return 0;
+    }
+    if (_flash.at45_erase_range(_addr, _blocks * AT45_FTL_BLOCK_PAGES * _flash.at45_page_size()) != AT45DB::AT45_OK) {
+        return 0;
+    }
+    for (b=0; b<_blocks; b++) {
+        _erases[b]++;
+        _state[b] = BLOCK_FREE;
+    }
+    memset(_valid_count, 0, sizeof(_valid_count));
+    memset(_mapped, 0, sizeof(_mapped));
+    memset(_hot, 0, sizeof(_hot));
+    memset(_valid, 0, sizeof(_valid));
+    _free = _blocks;
+    _open[STREAM_HOT] = _open[STREAM_COLD] = AT45_FTL_NONE;
+    _victim = AT45_FTL_NONE;
+    return 1;
+}
+
+bool AT45DBFtl::read(uint32_t lpn, uint8_t *buff)
+{
+    page_header     hdr;
+    at45_segment    seg[2];
+
+    if (lpn >= _pages) {
+        return 0;
+    }
+    if (!AT45DBFtl::bit_get(_mapped, lpn)) {
+        memset(buff, 0xff, AT45DBFtl::page_size());
+        return 1;
+    }
+    if (!AT45DBFtl::wait_programmed()) {
+        return 0;
+    }
+    // header and data in one continuous read
+    seg[0].buff = (uint8_t *)&hdr;
+    seg[0].size = sizeof(hdr);
+    seg[1].buff = buff;
+    seg[1].size = AT45DBFtl::page_size();
+    _flash.at45_readv(AT45DBFtl::page_addr(AT45DBFtl::map_get(lpn)), seg, 2);
+    return (hdr.lpn == lpn) && (hdr.dcrc == at45_crc16(buff, AT45DBFtl::page_size()));
+}
+
+bool AT45DBFtl::write(uint32_t lpn, const uint8_t *buff)
+{
+    page_header     hdr;
+    uint32_t        page;
+    bool            hot;
+
+    if (lpn >= _pages) {
+        return 0;
+    }
+    while (_free < AT45_FTL_RESERVE) {
+        if (!AT45DBFtl::gc_step()) {
+            return 0;
+        }
+    }
+    hot = AT45DBFtl::bit_get(_mapped, lpn);
+    page = AT45DBFtl::alloc(hot ? STREAM_HOT : STREAM_COLD);
+    if (page == AT45_FTL_NONE) {
+        return 0;
+    }
+    hdr.lpn = (uint16_t)lpn;
+    hdr.dcrc = at45_crc16(buff, AT45DBFtl::page_size());
+    AT45DBFtl::seal_header(&hdr);
+    if (!AT45DBFtl::program(page, &hdr, buff)) {
+        return 0;
+    }
+    AT45DBFtl::place(lpn, page);
+    AT45DBFtl::bit_set(_hot, lpn, hot);
+    return 1;
+}
+
+bool AT45DBFtl::gc_step(void)
+{
+    uint32_t    page;
+
+    if (_victim == AT45_FTL_NONE) {
+        _victim = AT45DBFtl::pick_victim();
+        if (_victim == AT45_FTL_NONE) {
+            return 0;
+        }
+        _gc_page = 0;
+    }
+    while (_gc_page < AT45_FTL_BLOCK_PAGES) {
+        page = _victim * AT45_FTL_BLOCK_PAGES + _gc_page++;
+        if (AT45DBFtl::bit_get(_valid, page)) {
+            return AT45DBFtl::relocate(page);
+        }
+    }
+    page = _victim;
+    _victim = AT45_FTL_NONE;
+    return AT45DBFtl::erase_block(page);
+}
+
+bool AT45DBFtl::sync(void)
+{
+    return AT45DBFtl::wait_programmed();
+}
+
+uint32_t AT45DBFtl::page_size(void)
+{
+    return _flash.at45_page_size() - sizeof(page_header);
+}
+
+uint32_t AT45DBFtl::pages(void)
+{
+    return _pages;
+}
+
+uint32_t AT45DBFtl::free_blocks(void)
+{
+    return _free;
+}
+
+void AT45DBFtl::wear(uint32_t *min, uint32_t *max)
+{
+    uint32_t    b;
+
+    *min = AT45_FTL_NONE;
+    *max = 0;
+    for (b=0; b<_blocks; b++) {
+        if (_erases[b] < *min) {
+            *min = _erases[b];
+        }
+        if (_erases[b] > *max) {
+            *max = _erases[b];
+        }
+    }
+}
+
+/*
+ * Map entries are AT45_FTL_MAP_BITS wide, packed LSB first
+ */
+uint32_t AT45DBFtl::map_get(uint32_t lpn)
+{
+    uint32_t    bit = lpn * AT45_FTL_MAP_BITS;
+    uint32_t    v;
+
+    v = _map[bit >> 3] | (_map[(bit >> 3) + 1] << 8) | (_map[(bit >> 3) + 2] << 16);
+    return (v >> (bit & 7)) & ((1UL << AT45_FTL_MAP_BITS) - 1);
+}
+
+void AT45DBFtl::map_set(uint32_t lpn, uint32_t page)
+{
+    uint32_t    bit = lpn * AT45_FTL_MAP_BITS;
+    uint32_t    mask = ((1UL << AT45_FTL_MAP_BITS) - 1) << (bit & 7);
+    uint32_t    v;
+    int         i;
+
+    v = _map[bit >> 3] | (_map[(bit >> 3) + 1] << 8) | (_map[(bit >> 3) + 2] << 16);
+    v = (v & ~mask) | ((page << (bit & 7)) & mask);
+    for (i=0; i<3; i++) {
+        _map[(bit >> 3) + i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+bool AT45DBFtl::bit_get(const uint8_t *bits, uint32_t i)
+{
+    return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+void AT45DBFtl::bit_set(uint8_t *bits, uint32_t i, bool value)
+{
+    if (value) {
+        bits[i >> 3] |= (uint8_t)(1 << (i & 7));
+    } else {
+        bits[i >> 3] &= (uint8_t)~(1 << (i & 7));
+    }
+}
+
+uint32_t AT45DBFtl::page_addr(uint32_t page)
+{
+    return _addr + page * _flash.at45_page_size();
+}
+
+/*
+ * @return true if the header is valid; hdr->seq is AT45_FTL_NONE if 
+ *          the header is erased
+ */
+bool AT45DBFtl::read_header(uint32_t page, page_header *hdr)
+{
+    _flash.at45_read(AT45DBFtl::page_addr(page), (uint8_t *)hdr, sizeof(*hdr));
+    return hdr->hcrc == at45_crc16((const uint8_t *)hdr, offsetof(page_header, hcrc));
+}
+
+/*
+ * Fill in the sequence number and padding. The erase count and header
+ * CRC are filled in by program(), which knows the block.
+ */
+void AT45DBFtl::seal_header(page_header *hdr)
+{
+    hdr->seq = _seq++;
+    hdr->pad = 0xffff;
+}
+
+/*
+ * Take the next erased page of the stream's block, opening the least 
+ * worn free block when the current one is full
+ */
+uint32_t AT45DBFtl::alloc(STREAMS stream)
+{
+    uint32_t    b, best = AT45_FTL_NONE;
+
+    if ((_open[stream] == AT45_FTL_NONE) || (_next[stream] == AT45_FTL_BLOCK_PAGES)) {
+        if (_open[stream] != AT45_FTL_NONE) {
+            _state[_open[stream]] = BLOCK_USED;
+            _open[stream] = AT45_FTL_NONE;
+        }
+        for (b=0; b<_blocks; b++) {
+            if ((_state[b] == BLOCK_FREE) && ((best == AT45_FTL_NONE) || (_erases[b] < _erases[best]))) {
+                best = b;
+            }
+        }
+        if (best == AT45_FTL_NONE) {
+            return AT45_FTL_NONE;
+        }
+        _state[best] = BLOCK_OPEN;
+        _free--;
+        _open[stream] = best;
+        _next[stream] = 0;
+    }
+    return _open[stream] * AT45_FTL_BLOCK_PAGES + _next[stream]++;
+}
+
+/*
+ * Clock the header and data into the idle buffer and program it without
+ * erase once the previous page has finished. 'data' NULL programs the
+ * buffer as loaded by at45_page2buffer, with only the header replaced.
+ */
+bool AT45DBFtl::program(uint32_t page, const page_header *hdr, const uint8_t *data)
+{
+    page_header     h = *hdr;
+
+    h.erases = _erases[page / AT45_FTL_BLOCK_PAGES];
+    h.hcrc = at45_crc16((const uint8_t *)&h, offsetof(page_header, hcrc));
+    _flash.at45_buffer_write(_buffer, 0, (const uint8_t *)&h, sizeof(h));
+    if (data != NULL) {
+        _flash.at45_buffer_write(_buffer, sizeof(h), data, AT45DBFtl::page_size());
+    }
+    if (!AT45DBFtl::wait_programmed()) {
+        return 0;
+    }
+    _flash.at45_buffer_program(_buffer, AT45DBFtl::page_addr(page), false);
+    _busy = true;
+    _buffer = (_buffer == AT45DB::AT45_BUFFER1) ? AT45DB::AT45_BUFFER2 : AT45DB::AT45_BUFFER1;
+    return 1;
+}
+
+/*
+ * Point a logical page at a physical page, dropping the old copy
+ */
+void AT45DBFtl::place(uint32_t lpn, uint32_t page)
+{
+    uint32_t    prev;
+
+    if (AT45DBFtl::bit_get(_mapped, lpn)) {
+        prev = AT45DBFtl::map_get(lpn);
+        if (AT45DBFtl::bit_get(_valid, prev)) {
+            AT45DBFtl::bit_set(_valid, prev, false);
+            _valid_count[prev / AT45_FTL_BLOCK_PAGES]--;
+        }
+    }
+    AT45DBFtl::map_set(lpn, page);
+    AT45DBFtl::bit_set(_mapped, lpn, true);
+    AT45DBFtl::bit_set(_valid, page, true);
+    _valid_count[page / AT45_FTL_BLOCK_PAGES]++;
+}
+
+/*
+ * Move a valid page to the cold stream. The data is copied inside the
+ * device (main memory page to buffer transfer); only the header is sent.
+ */
+bool AT45DBFtl::relocate(uint32_t page)
+{
+    page_header     hdr;
+    uint32_t        dest;
+
+    if (!AT45DBFtl::wait_programmed()) {
+        return 0;
+    }
+    if (!AT45DBFtl::read_header(page, &hdr) || (hdr.lpn >= _pages)) {
+        // cannot tell whose page it is: let it go with the block
+        AT45DBFtl::bit_set(_valid, page, false);
+        _valid_count[page / AT45_FTL_BLOCK_PAGES]--;
+        return 1;
+    }
+    dest = AT45DBFtl::alloc(STREAM_COLD);
+    if (dest == AT45_FTL_NONE) {
+        return 0;
+    }
+    _flash.at45_page2buffer(_buffer, AT45DBFtl::page_addr(page));
+    if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_TRANSFER) != AT45DB::AT45_OK) {
+        return 0;
+    }
+    AT45DBFtl::seal_header(&hdr);
+    if (!AT45DBFtl::program(dest, &hdr, NULL)) {
+        return 0;
+    }
+    AT45DBFtl::place(hdr.lpn, dest);
+    AT45DBFtl::bit_set(_hot, hdr.lpn, false);
+    return 1;
+}
+
+bool AT45DBFtl::erase_block(uint32_t block)
+{
+    if (!AT45DBFtl::wait_programmed()) {
+        return 0;
+    }
+    _flash.at45_eraseblock(AT45DBFtl::page_addr(block * AT45_FTL_BLOCK_PAGES));
+    if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_BLOCK_ERASE) != AT45DB::AT45_OK) {
+        return 0;
+    }
+    _erases[block]++;
+    _state[block] = BLOCK_FREE;
+    _free++;
+    return 1;
+}
+
+/*
+ * Static wear levelling takes the least worn block in use once the 
+ * spread of erase counts is too wide; otherwise take the block in use 
+ * with the fewest valid pages, if that frees anything.
+ */
+uint32_t AT45DBFtl::pick_victim(void)
+{
+    uint32_t    b, min, max;
+    uint32_t    best = AT45_FTL_NONE;
+
+    AT45DBFtl::wear(&min, &max);
+    if (max - min > AT45_FTL_WEAR_DELTA) {
+        for (b=0; b<_blocks; b++) {
+            if ((_state[b] == BLOCK_USED) && ((best == AT45_FTL_NONE) || (_erases[b] < _erases[best]))) {
+                best = b;
+            }
+        }
+        if ((best != AT45_FTL_NONE) && (_erases[best] + AT45_FTL_WEAR_DELTA < max)) {
+            return best;
+        }
+        best = AT45_FTL_NONE;
+    }
+    for (b=0; b<_blocks; b++) {
+        if ((_state[b] == BLOCK_USED) && (_valid_count[b] < AT45_FTL_BLOCK_PAGES) &&
+            ((best == AT45_FTL_NONE) || (_valid_count[b] < _valid_count[best]))) {
+            best = b;
+        }
+    }
+    return best;
+}
+
+bool AT45DBFtl::wait_programmed(void)
+{
+    if (_busy) {
+        _busy = false;
+        if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_PROGRAM) != AT45DB::AT45_OK) {
+            return 0;
+        }
+    }
+    return 1;
+}
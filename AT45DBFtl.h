@@ -0,0 +1,222 @@
+/* 
+ * @file    AT45DBFtl.h
+ * @brief   Wear-levelling flash translation layer for the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBFTL_H_
+#define _AT45DBFTL_H_
+
+#include "AT45DB.h"
+#include "AT45DBCrc.h"
+
+#ifndef AT45_FTL_PAGES
+#define AT45_FTL_PAGES      AT45_PAGE_COUNT     // most pages managed (sizes the RAM tables)
+#endif  // AT45_FTL_PAGES
+
+#ifndef AT45_FTL_SPARE
+#define AT45_FTL_SPARE      16                  // 1 block in N kept spare (over-provisioning), at least 4
+#endif  // AT45_FTL_SPARE
+
+#ifndef AT45_FTL_WEAR_DELTA
+#define AT45_FTL_WEAR_DELTA 64                  // erase count spread that starts static wear levelling
+#endif  // AT45_FTL_WEAR_DELTA
+
+#define AT45_FTL_BLOCK_PAGES    8               // pages per block on every part in at45_devices
+#define AT45_FTL_BLOCKS         (AT45_FTL_PAGES / AT45_FTL_BLOCK_PAGES)
+#define AT45_FTL_RESERVE        2               // free blocks held back for garbage collection
+#define AT45_FTL_NONE           0xFFFFFFFF
+
+/*
+ * Bits needed to hold a page index below n
+ */
+constexpr uint32_t at45_ftl_bits(uint32_t n, uint32_t b = 1)
+{
+    return ((1UL << b) >= n) ? b : at45_ftl_bits(n, b + 1);
+}
+
+#define AT45_FTL_MAP_BITS       at45_ftl_bits(AT45_FTL_PAGES)
+
+/**
+ * Flash translation layer: logical pages on wear-levelled physical pages
+ *
+ * A logical page is rewritten into a fresh erased page (program without 
+ * erase) and the old copy is left invalid; whole blocks are erased by 
+ * garbage collection once their valid pages have been moved. Writes to
+ * pages that already hold data go to a "hot" block, first writes and 
+ * pages moved by garbage collection go to a "cold" block, so blocks tend
+ * to fill with data of one temperature and clean up cheaply.
+ *
+ * - dynamic wear levelling: a new block is the free block with the 
+ *   fewest erases
+ * - static wear levelling: once the erase count spread passes 
+ *   AT45_FTL_WEAR_DELTA the least worn block in use is collected, moving
+ *   its static data onto a worn block
+ * - garbage collection: gc_step() does one page move or block erase, for
+ *   calling when idle; write() calls it when free blocks run short
+ *
+ * Each page starts with a 16 byte header (sequence number, erase count
+ * of the block, logical page, CRCs), so a logical page is the page size
+ * less 16 bytes. mount() rebuilds the tables from the headers, reading 
+ * 16 bytes of every page. The logical to physical map is bit-packed at
+ * AT45_FTL_MAP_BITS per page: about 11KB of RAM in all for 4096 pages.
+ */
+class AT45DBFtl
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device
+     * @param addr = address of the first block managed (block aligned)
+     * @param blocks = number of blocks managed
+     */
+    AT45DBFtl(AT45DB &flash, uint32_t addr, uint32_t blocks);
+
+    ~AT45DBFtl();
+
+    /*
+     * Rebuild the map, erase counts and free blocks from the page headers
+     *
+     * @return false if the range does not fit the RAM tables
+     */
+    bool mount(void);
+
+    /*
+     * Erase the range, dropping all logical pages
+     *
+     * @return true = success
+     */
+    bool format(void);
+
+    /*
+     * Read a logical page. A page never written reads as FFh.
+     *
+     * @param lpn = logical page number, below pages()
+     * @param *buff = pointer to destination memory buffer, page_size() bytes
+     * @return false if the page is out of range or fails its CRC
+     */
+    bool read(uint32_t lpn, uint8_t *buff);
+
+    /*
+     * Write a logical page into a fresh physical page
+     *
+     * @param lpn = logical page number, below pages()
+     * @param *buff = pointer to source in CPU memory space, page_size() bytes
+     * @return false if the page is out of range, no space could be 
+     *          reclaimed or a program failed
+     */
+    bool write(uint32_t lpn, const uint8_t *buff);
+
+    /*
+     * Do one step of garbage collection: move one valid page out of the
+     * block being collected, or erase it once empty
+     *
+     * @return false if there was nothing to collect or a step failed
+     */
+    bool gc_step(void);
+
+    /*
+     * Wait for the last page program
+     *
+     * @return true = programmed without erase/program error
+     */
+    bool sync(void);
+
+    /*
+     * @return bytes in a logical page
+     */
+    uint32_t page_size(void);
+
+    /*
+     * @return number of logical pages
+     */
+    uint32_t pages(void);
+
+    /*
+     * @return number of erased blocks ready for writing
+     */
+    uint32_t free_blocks(void);
+
+    /*
+     * @param *min = fewest erases of any block
+     * @param *max = most erases of any block
+     */
+    void wear(uint32_t *min, uint32_t *max);
+
+private:
+
+    enum BLOCKSTATE {
+        BLOCK_FREE,                             // erased
+        BLOCK_OPEN,                             // being filled
+        BLOCK_USED,
+    };
+
+    enum STREAMS {
+        STREAM_HOT,
+        STREAM_COLD,
+    };
+
+    struct page_header {
+        uint32_t        seq;                    // write order, the highest copy of a page wins
+        uint32_t        erases;                 // erase count of the block
+        uint16_t        lpn;
+        uint16_t        dcrc;                   // of the data
+        uint16_t        hcrc;                   // of the fields above
+        uint16_t        pad;                    // FFFFh
+    };
+
+    AT45DB              &_flash;
+    uint32_t            _addr;
+    uint32_t            _blocks;
+    uint32_t            _pages;                 // logical pages
+    uint32_t            _seq;
+    uint32_t            _free;
+    uint32_t            _open[2];               // block being filled per STREAMS
+    uint32_t            _next[2];               // next page in it
+    uint32_t            _victim;                // block being collected
+    uint32_t            _gc_page;               // next page to check in it
+    AT45DB::BUFFERS     _buffer;                // buffer for the next program
+    bool                _busy;                  // a page program may be in progress
+    uint32_t            _erases[AT45_FTL_BLOCKS];
+    uint8_t             _valid_count[AT45_FTL_BLOCKS];
+    uint8_t             _state[AT45_FTL_BLOCKS];
+    uint8_t             _map[(AT45_FTL_PAGES * AT45_FTL_MAP_BITS + 7) / 8 + 2];
+    uint8_t             _mapped[AT45_FTL_PAGES / 8];   // logical page holds data
+    uint8_t             _hot[AT45_FTL_PAGES / 8];      // logical page rewritten since it was last moved
+    uint8_t             _valid[AT45_FTL_PAGES / 8];    // physical page holds the current copy
+
+    uint32_t map_get(uint32_t lpn);
+    void map_set(uint32_t lpn, uint32_t page);
+    static bool bit_get(const uint8_t *bits, uint32_t i);
+    static void bit_set(uint8_t *bits, uint32_t i, bool value);
+
+    uint32_t page_addr(uint32_t page);
+    bool read_header(uint32_t page, page_header *hdr);
+    void seal_header(page_header *hdr);
+    uint32_t alloc(STREAMS stream);
+    bool program(uint32_t page, const page_header *hdr, const uint8_t *data);
+    void place(uint32_t lpn, uint32_t page);
+    bool relocate(uint32_t page);
+    bool erase_block(uint32_t block);
+    uint32_t pick_victim(void);
+    bool wait_programmed(void);
+
+};
+
+#endif // _AT45DBFTL_H_
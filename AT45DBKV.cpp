@@ -0,0 +1,639 @@
+/* 
+ * @file    AT45DBKV.cpp
+ * @brief   Key-value store on the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBKV.h"
+
+#define SLOT_EMPTY          0
+#define SLOT_REMOVED        1                   // tag of a slot whose key was removed
+#define SLOT_TAG(s)         ((s) >> 24)
+#define SLOT_LOC(s)         ((s) & 0xffffff)
+#define SLOT_MASK           (AT45_KV_SLOTS - 1)
+#define SLOT_LIMIT          (AT45_KV_SLOTS / 4 * 3)
+#define KV_NONE             0xFFFFFFFF
+
+// tags 2..255 from the top byte of the hash
+#define KV_TAG(h)           (2 + ((h) >> 24) % 254)
+
+AT45DBKV::AT45DBKV(AT45DB &flash, uint32_t addr, uint32_t blocks) :
+        _flash(flash), _addr(addr), _blocks(blocks), _pages(blocks * flash.at45_block_pages()),
+        _seq0(0), _page(0), _fill(0), _tail(0), _gc_page(0), _gc_offset(0), _count(0),
+        _buffer(AT45DB::AT45_BUFFER1), _busy(false), _busy_op(AT45DB::AT45_OP_PROGRAM),
+        _failed(false), _unerased(false)
+{
+    memset(_slot, 0, sizeof(_slot));
+}
+
+AT45DBKV::~AT45DBKV() { }
+
+/*
+ * The head is found as in AT45DBRing. The last page written records the
+ * tail; it may be older than the tail reached by compaction since, in 
+ * which case entries already copied are indexed twice and the later 
+ * copy wins.
+ */
+bool AT45DBKV::mount(void)
+{
+    uint32_t        bp = _flash.at45_block_pages();
+    uint32_t        page_size = _flash.at45_page_size();
+    page_header     hdr;
+    entry_header    eh;
+    uint32_t        lo, hi, mid, last, page, offset, size;
+
+    if ((_blocks < AT45_KV_RESERVE + 2) || (_pages > 0x8000) || (_pages * page_size > 0x1000000)) {
+        return 0;
+    }
+    AT45DBKV::wait_idle();
+    memset(_slot, 0, sizeof(_slot));
+    _count = 0;
+    _fill = 0;
+    _gc_page = 0;
+    _gc_offset = 0;
+    last = KV_NONE;
+
+    if (AT45DBKV::read_header(0, &hdr)) {
+        _seq0 = hdr.seq;
+        // page 'lo' is in this lap, page 'hi' is not or is past the end
+        lo = 0;
+        hi = _pages;
+        while (hi - lo > 1) {
+            mid = lo + (hi - lo) / 2;
+            if (AT45DBKV::in_lap(mid)) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        last = lo;
+        _page = hi;
+        // a page torn by a power failure cannot be programmed again
+        while ((_page < _pages) && (_page % bp)) {
+            if (!AT45DBKV::read_header(_page, &hdr) && (hdr.magic == 0xffff)) {
+                break;
+            }
+            _page++;
+        }
+        if (_page == _pages) {
+            _page = 0;
+            _seq0 = (uint16_t)(_seq0 + _pages);
+        }
+    } else {
+        _page = 0;
+        if (AT45DBKV::read_header(_pages - 1, &hdr)) {
+            _seq0 = (uint16_t)(hdr.seq + 1);
+            last = _pages - 1;
+        }
+    }
+    if (last == KV_NONE) {
+        _tail = _page / bp;
+        return 1;
+    }
+    AT45DBKV::read_header(last, &hdr);
+    if (hdr.tail >= _blocks) {
+        return 0;
+    }
+    _tail = hdr.tail;
+
+    // replay the entries from the tail to the head
+    for (page=_tail*bp; page!=_page; page=(page+1)%_pages) {
+        _flash.at45_read(_addr + page * page_size, _gc, page_size);
+        memcpy(&hdr, _gc, sizeof(hdr));
+        if ((hdr.magic != AT45_KV_MAGIC) || (hdr.crc != at45_crc16(_gc, offsetof(page_header, crc)))) {
+            continue;
+        }
+        for (offset=sizeof(hdr); offset+sizeof(eh)<=page_size; offset+=size) {
+            memcpy(&eh, &_gc[offset], sizeof(eh));
+            size = sizeof(eh) + eh.klen + eh.vlen;
+            if ((eh.klen == 0xff) || (offset + size > page_size)) {
+                break;
+            }
+            if (eh.crc != at45_crc16(&_gc[offset + sizeof(eh)], eh.klen + eh.vlen, 
+                                     at45_crc16(&_gc[offset], offsetof(entry_header, crc)))) {
+                continue;
+            }
+            if (!AT45DBKV::index(&_gc[offset + sizeof(eh)], eh.klen, (KINDS)eh.kind, page * page_size + offset)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+bool AT45DBKV::format(void)
+{
+    if (!AT45DBKV::wait_busy()) {
+        return 0;
+    }
+    _seq0 = (uint16_t)(_seq0 + _page + (_fill ? 1 : 0));
+    _page = 0;
+    _fill = 0;
+    _tail = 0;
+    _gc_page = 0;
+    _gc_offset = 0;
+    _count = 0;
+    _unerased = false;
+    memset(_slot, 0, sizeof(_slot));
+    return _flash.at45_erase_range(_addr, _pages * _flash.at45_page_size()) == AT45DB::AT45_OK;
+}
+
+bool AT45DBKV::get(const char *key, uint8_t *buff, uint32_t size, uint32_t *len)
+{
+    uint32_t        page_size = _flash.at45_page_size();
+    uint32_t        klen = strlen(key);
+    uint32_t        h = AT45DBKV::hash((const uint8_t *)key, klen);
+    uint32_t        i = h & SLOT_MASK;
+    uint32_t        n, s, loc, room;
+    uint8_t         kbuf[AT45_KV_KEY_MAX];
+    entry_header    eh;
+    at45_segment    seg[3];
+
+    if ((klen == 0) || (klen > AT45_KV_KEY_MAX)) {
+        return 0;
+    }
+    for (n=0; n<AT45_KV_SLOTS; n++, i=(i+1)&SLOT_MASK) {
+        s = _slot[i];
+        if (s == SLOT_EMPTY) {
+            return 0;
+        }
+        if (SLOT_TAG(s) != KV_TAG(h)) {
+            continue;
+        }
+        loc = SLOT_LOC(s);
+        room = page_size - (loc % page_size);
+        if (sizeof(eh) + klen > room) {
+            continue;
+        }
+        // entry header, key and as much of the value as fits, in one read
+        seg[0].buff = (uint8_t *)&eh;
+        seg[0].size = sizeof(eh);
+        seg[1].buff = kbuf;
+        seg[1].size = klen;
+        seg[2].buff = buff;
+        seg[2].size = (size < room - sizeof(eh) - klen) ? size : room - sizeof(eh) - klen;
+        if (_fill && (loc / page_size == _page)) {
+            memcpy(&eh, &_head[loc % page_size], sizeof(eh));
+            memcpy(kbuf, &_head[loc % page_size + sizeof(eh)], klen);
+            memcpy(buff, &_head[loc % page_size + sizeof(eh) + klen], seg[2].size);
+        } else {
+            AT45DBKV::wait_idle();
+            _flash.at45_readv(_addr + loc, seg, seg[2].size ? 3 : 2);
+        }
+        if ((eh.klen == klen) && (memcmp(kbuf, key, klen) == 0)) {
+            *len = eh.vlen;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool AT45DBKV::put(const char *key, const void *value, uint32_t len)
+{
+    uint32_t    klen = strlen(key);
+    uint32_t    h = AT45DBKV::hash((const uint8_t *)key, klen);
+    uint32_t    loc, tries;
+    int         i, free;
+
+    if ((klen == 0) || (klen > AT45_KV_KEY_MAX) || 
+        (klen + len > _flash.at45_page_size() - AT45DBKV::overhead())) {
+        return 0;
+    }
+    i = AT45DBKV::find((const uint8_t *)key, klen, h, &free);
+    if ((i < 0) && ((free < 0) || (_count >= SLOT_LIMIT))) {
+        return 0;
+    }
+    // compaction moves entries but not slots, so 'i' and 'free' still hold
+    for (tries=0; AT45DBKV::free_blocks() < AT45_KV_RESERVE; tries++) {
+        if ((tries >= _blocks) || !AT45DBKV::compact_block()) {
+            return 0;
+        }
+    }
+    if (!AT45DBKV::emit(KIND_PUT, (const uint8_t *)key, klen, (const uint8_t *)value, len, &loc)) {
+        return 0;
+    }
+    if (i < 0) {
+        i = free;
+        _count++;
+    }
+    _slot[i] = ((uint32_t)KV_TAG(h) << 24) | loc;
+    return 1;
+}
+
+bool AT45DBKV::remove(const char *key)
+{
+    uint32_t    klen = strlen(key);
+    uint32_t    h = AT45DBKV::hash((const uint8_t *)key, klen);
+    uint32_t    loc, tries;
+    int         i, free;
+
+    if ((klen == 0) || (klen > AT45_KV_KEY_MAX)) {
+        return 0;
+    }
+    i = AT45DBKV::find((const uint8_t *)key, klen, h, &free);
+    if (i < 0) {
+        return 0;
+    }
+    for (tries=0; AT45DBKV::free_blocks() < AT45_KV_RESERVE; tries++) {
+        if ((tries >= _blocks) || !AT45DBKV::compact_block()) {
+            return 0;
+        }
+    }
+    if (!AT45DBKV::emit(KIND_REMOVE, (const uint8_t *)key, klen, NULL, 0, &loc)) {
+        return 0;
+    }
+    _slot[i] = (uint32_t)SLOT_REMOVED << 24;
+    _count--;
+    return 1;
+}
+
+bool AT45DBKV::sync(void)
+{
+    if (_fill && !AT45DBKV::commit()) {
+        return 0;
+    }
+    return AT45DBKV::wait_busy();
+}
+
+bool AT45DBKV::compact(uint32_t budget_us)
+{
+    uint32_t    start = _flash.at45_now_us();
+
+    while ((AT45DBKV::free_blocks() < AT45_KV_FREE) && (_tail != AT45DBKV::last_block())) {
+        if (!AT45DBKV::compact_step()) {
+            return 0;
+        }
+        if ((uint32_t)(_flash.at45_now_us() - start) >= budget_us) {
+            break;
+        }
+    }
+    return (AT45DBKV::free_blocks() < AT45_KV_FREE) && (_tail != AT45DBKV::last_block());
+}
+
+uint32_t AT45DBKV::count(void)
+{
+    return _count;
+}
+
+/*
+ * The head's next block meeting the tail means the store is empty; 
+ * emit() never lets the head enter the last free block, so it cannot 
+ * mean full.
+ */
+uint32_t AT45DBKV::free_blocks(void)
+{
+    uint32_t    bp = _flash.at45_block_pages();
+    uint32_t    next = _page / bp;
+
+    if ((_page % bp) || _fill) {
+        next = (next + 1) % _blocks;
+    }
+    if (next == _tail) {
+        return _blocks;
+    }
+    return (_tail + _blocks - next) % _blocks;
+}
+
+/*
+ * FNV-1a
+ */
+uint32_t AT45DBKV::hash(const uint8_t *key, uint32_t klen)
+{
+    uint32_t    h = 2166136261UL;
+
+    while (klen--) {
+        h = (h ^ *key++) * 16777619UL;
+    }
+    return h;
+}
+
+/*
+ * Look a key up in the index, reading the key of each slot whose tag 
+ * matches. 'free' receives the first slot the key could be inserted at.
+ *
+ * @return slot holding the key, or -1
+ */
+int AT45DBKV::find(const uint8_t *key, uint32_t klen, uint32_t h, int *free)
+{
+    uint32_t        i = h & SLOT_MASK;
+    uint32_t        n, s;
+    uint8_t         buff[sizeof(entry_header) + AT45_KV_KEY_MAX];
+    entry_header    eh;
+
+    *free = -1;
+    for (n=0; n<AT45_KV_SLOTS; n++, i=(i+1)&SLOT_MASK) {
+        s = _slot[i];
+        if (s == SLOT_EMPTY) {
+            if (*free < 0) {
+                *free = i;
+            }
+            return -1;
+        }
+        if (SLOT_TAG(s) == SLOT_REMOVED) {
+            if (*free < 0) {
+                *free = i;
+            }
+            continue;
+        }
+        if (SLOT_TAG(s) != KV_TAG(h)) {
+            continue;
+        }
+        AT45DBKV::fetch(SLOT_LOC(s), buff, sizeof(eh) + klen);
+        memcpy(&eh, buff, sizeof(eh));
+        if ((eh.klen == klen) && (memcmp(&buff[sizeof(eh)], key, klen) == 0)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Apply an entry found by mount() to the index
+ */
+bool AT45DBKV::index(const uint8_t *key, uint32_t klen, KINDS kind, uint32_t loc)
+{
+    uint32_t    h = AT45DBKV::hash(key, klen);
+    int         i, free;
+
+    i = AT45DBKV::find(key, klen, h, &free);
+    if (kind == KIND_REMOVE) {
+        if (i >= 0) {
+            _slot[i] = (uint32_t)SLOT_REMOVED << 24;
+            _count--;
+        }
+        return 1;
+    }
+    if (i < 0) {
+        if ((free < 0) || (_count >= SLOT_LIMIT)) {
+            return 0;
+        }
+        i = free;
+        _count++;
+    }
+    _slot[i] = ((uint32_t)KV_TAG(h) << 24) | loc;
+    return 1;
+}
+
+/*
+ * Append an entry to the head page, programming the head page first if
+ * the entry does not fit. A page at the start of a block erases the 
+ * block, as long as another free block remains.
+ */
+bool AT45DBKV::emit(KINDS kind, const uint8_t *key, uint32_t klen, const uint8_t *value, uint32_t vlen, uint32_t *loc)
+{
+    uint32_t        page_size = _flash.at45_page_size();
+    uint32_t        size = sizeof(entry_header) + klen + vlen;
+    page_header     hdr;
+    entry_header    eh;
+
+    if (_fill && (_fill + size > page_size)) {
+        if (!AT45DBKV::commit()) {
+            return 0;
+        }
+    }
+    if (!_fill) {
+        if ((_page % _flash.at45_block_pages()) == 0) {
+            if ((AT45DBKV::free_blocks() < 2) || !AT45DBKV::wait_busy()) {
+                return 0;
+            }
+            _flash.at45_eraseblock(_addr + _page * page_size);
+            _busy = true;
+            _busy_op = AT45DB::AT45_OP_BLOCK_ERASE;
+        }
+        memset(_head, 0xff, page_size);
+        hdr.seq = (uint16_t)(_seq0 + _page);
+        hdr.tail = (uint16_t)_tail;
+        hdr.magic = AT45_KV_MAGIC;
+        hdr.crc = at45_crc16((const uint8_t *)&hdr, offsetof(page_header, crc));
+        memcpy(_head, &hdr, sizeof(hdr));
+        _fill = sizeof(hdr);
+    }
+    eh.klen = (uint8_t)klen;
+    eh.kind = (uint8_t)kind;
+    eh.vlen = (uint16_t)vlen;
+    eh.crc = at45_crc16(value, vlen, at45_crc16(key, klen, 
+             at45_crc16((const uint8_t *)&eh, offsetof(entry_header, crc))));
+    memcpy(&_head[_fill], &eh, sizeof(eh));
+    memcpy(&_head[_fill + sizeof(eh)], key, klen);
+    if (vlen) {
+        memcpy(&_head[_fill + sizeof(eh) + klen], value, vlen);
+    }
+    *loc = _page * page_size + _fill;
+    _fill += size;
+    return 1;
+}
+
+/*
+ * One step of compaction of the tail block: load a page, copy one live
+ * entry to the head, or move the tail on once the block is done. Remove
+ * entries are dropped: every older entry for the key is in this block 
+ * or an older one, and has gone already or goes with it.
+ *
+ * @return false if there is nothing to compact or an entry could not be
+ *          copied
+ */
+bool AT45DBKV::compact_step(void)
+{
+    uint32_t        bp = _flash.at45_block_pages();
+    uint32_t        page_size = _flash.at45_page_size();
+    uint32_t        page = _tail * bp + _gc_page;
+    page_header     hdr;
+    entry_header    eh;
+    const uint8_t   *key;
+    uint32_t        size, loc, h, i, n, s;
+
+    if ((AT45DBKV::free_blocks() == _blocks) || (_tail == AT45DBKV::last_block())) {
+        return 0;
+    }
+    if (_gc_page == bp) {
+        _tail = (_tail + 1) % _blocks;
+        _gc_page = 0;
+        return 1;
+    }
+    if (_gc_offset == 0) {
+        if (!AT45DBKV::wait_busy()) {
+            return 0;
+        }
+        _flash.at45_read(_addr + page * page_size, _gc, page_size);
+        memcpy(&hdr, _gc, sizeof(hdr));
+        if ((hdr.magic != AT45_KV_MAGIC) || (hdr.crc != at45_crc16(_gc, offsetof(page_header, crc)))) {
+            _gc_page++;
+        } else {
+            _gc_offset = sizeof(hdr);
+        }
+        return 1;
+    }
+
+    if (_gc_offset + sizeof(eh) <= page_size) {
+        memcpy(&eh, &_gc[_gc_offset], sizeof(eh));
+    }
+    size = sizeof(eh) + eh.klen + eh.vlen;
+    if ((_gc_offset + sizeof(eh) > page_size) || (eh.klen == 0xff) || (_gc_offset + size > page_size)) {
+        _gc_page++;
+        _gc_offset = 0;
+        return 1;
+    }
+    key = &_gc[_gc_offset + sizeof(eh)];
+    loc = page * page_size + _gc_offset;
+    _gc_offset += size;
+    if (eh.kind != KIND_PUT) {
+        return 1;
+    }
+
+    // live if a slot on the key's probe sequence points at this entry
+    h = AT45DBKV::hash(key, eh.klen);
+    i = h & SLOT_MASK;
+    for (n=0; n<AT45_KV_SLOTS; n++, i=(i+1)&SLOT_MASK) {
+        s = _slot[i];
+        if (s == SLOT_EMPTY) {
+            break;
+        }
+        if ((SLOT_TAG(s) == KV_TAG(h)) && (SLOT_LOC(s) == loc)) {
+            if (!AT45DBKV::emit(KIND_PUT, key, eh.klen, key + eh.klen, eh.vlen, &loc)) {
+                return 0;
+            }
+            _slot[i] = ((uint32_t)KV_TAG(h) << 24) | loc;
+            break;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Compact until the tail moves on by a block
+ */
+bool AT45DBKV::compact_block(void)
+{
+    uint32_t    tail = _tail;
+
+    while (_tail == tail) {
+        if (!AT45DBKV::compact_step()) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * @return block holding the newest entries
+ */
+uint32_t AT45DBKV::last_block(void)
+{
+    uint32_t    bp = _flash.at45_block_pages();
+    uint32_t    hb = _page / bp;
+
+    if ((_page % bp) || _fill) {
+        return hb;
+    }
+    return (hb + _blocks - 1) % _blocks;
+}
+
+/*
+ * @return true if the header is valid; hdr->magic is FFFFh if the 
+ *          header is erased
+ */
+bool AT45DBKV::read_header(uint32_t page, page_header *hdr)
+{
+    AT45DBKV::wait_idle();
+    _flash.at45_read(_addr + page * _flash.at45_page_size(), (uint8_t *)hdr, sizeof(*hdr));
+    return (hdr->magic == AT45_KV_MAGIC) && (hdr->crc == at45_crc16((const uint8_t *)hdr, offsetof(page_header, crc)));
+}
+
+bool AT45DBKV::in_lap(uint32_t page)
+{
+    page_header     hdr;
+
+    return AT45DBKV::read_header(page, &hdr) && (hdr.seq == (uint16_t)(_seq0 + page));
+}
+
+/*
+ * Copy bytes at an offset in the range from the RAM head page or flash
+ */
+void AT45DBKV::fetch(uint32_t loc, uint8_t *buff, uint32_t size)
+{
+    uint32_t    page_size = _flash.at45_page_size();
+
+    if (_fill && (loc / page_size == _page)) {
+        memcpy(buff, &_head[loc % page_size], size);
+    } else {
+        AT45DBKV::wait_idle();
+        _flash.at45_read(_addr + loc, buff, size);
+    }
+}
+
+/*
+ * Clock the head page into the idle buffer, program it without erase 
+ * once the previous operation has finished, and move the head on. As in
+ * AT45DBRing, a block whose erase failed is erased again first.
+ */
+bool AT45DBKV::commit(void)
+{
+    _flash.at45_buffer_write(_buffer, 0, _head, _flash.at45_page_size());
+    if (!AT45DBKV::wait_busy()) {
+        return 0;
+    }
+    if (_unerased) {
+        _unerased = false;
+        _flash.at45_eraseblock(_addr + _page * _flash.at45_page_size());
+        _busy = true;
+        _busy_op = AT45DB::AT45_OP_BLOCK_ERASE;
+        if (!AT45DBKV::wait_busy()) {
+            return 0;
+        }
+    }
+    _flash.at45_buffer_program(_buffer, _addr + _page * _flash.at45_page_size(), false);
+    _busy = true;
+    _busy_op = AT45DB::AT45_OP_PROGRAM;
+    _buffer = (_buffer == AT45DB::AT45_BUFFER1) ? AT45DB::AT45_BUFFER2 : AT45DB::AT45_BUFFER1;
+    _fill = 0;
+    if (++_page == _pages) {
+        _page = 0;
+        _seq0 = (uint16_t)(_seq0 + _pages);
+    }
+    return 1;
+}
+
+/*
+ * Wait for the program or erase in progress and record a failure, which
+ * stays set until wait_busy() reports it
+ */
+void AT45DBKV::wait_idle(void)
+{
+    if (_busy) {
+        _busy = false;
+        if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, _busy_op) != AT45DB::AT45_OK) {
+            _failed = true;
+            if (_busy_op == AT45DB::AT45_OP_BLOCK_ERASE) {
+                _unerased = true;
+            }
+        }
+    }
+}
+
+/*
+ * @return false if a program or erase has failed since the last report
+ */
+bool AT45DBKV::wait_busy(void)
+{
+    AT45DBKV::wait_idle();
+    if (_failed) {
+        _failed = false;
+        return 0;
+    }
+    return 1;
+}
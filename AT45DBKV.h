@@ -0,0 +1,217 @@
+/* 
+ * @file    AT45DBKV.h
+ * @brief   Key-value store on the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBKV_H_
+#define _AT45DBKV_H_
+
+#include "AT45DB.h"
+#include "AT45DBCrc.h"
+
+#ifndef AT45_KV_SLOTS
+#define AT45_KV_SLOTS       4096                // index slots, a power of 2: 4 bytes of RAM each, 3/4 usable
+#endif  // AT45_KV_SLOTS
+
+#ifndef AT45_KV_KEY_MAX
+#define AT45_KV_KEY_MAX     32                  // longest key in bytes
+#endif  // AT45_KV_KEY_MAX
+
+#ifndef AT45_KV_FREE
+#define AT45_KV_FREE        4                   // compact() works while fewer blocks than this are free
+#endif  // AT45_KV_FREE
+
+#define AT45_KV_MAGIC       0x4b56              // page header marker
+#define AT45_KV_RESERVE     3                   // free blocks put() keeps for compaction to copy into
+
+/**
+ * Key-value store for small blobs, log-structured in a range of blocks
+ *
+ * Every put or remove appends an entry (key length, kind, value length,
+ * CRC16, key, value) to a RAM copy of the head page, which is programmed
+ * without erase when full, so a small put costs a fraction of a page 
+ * program. Blocks are used as a ring: the head erases a block as it 
+ * enters it, and compaction copies the live entries out of the oldest
+ * (tail) block so the head can reuse it.
+ *
+ * The RAM index is an open addressing hash table of AT45_KV_SLOTS 
+ * words, each an 8 bit tag from the key hash and the 24 bit offset of 
+ * the entry in the range. get() reads the entry header, key and value 
+ * in one continuous read; only a tag collision costs another read.
+ *
+ * Page headers hold a wrapping sequence number, as in AT45DBRing, and
+ * the tail block when the page was started. mount() finds the head by
+ * binary search and rebuilds the index by reading the pages from the 
+ * tail to the head once.
+ *
+ * Entries do not span pages: key plus value are at most the page size
+ * less AT45DBKV::overhead() bytes.
+ */
+class AT45DBKV
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device holding the store
+     * @param addr = address of the first block (block aligned)
+     * @param blocks = number of blocks, at least AT45_KV_RESERVE + 2
+     */
+    AT45DBKV(AT45DB &flash, uint32_t addr, uint32_t blocks);
+
+    ~AT45DBKV();
+
+    /*
+     * Find the head and tail and rebuild the index
+     *
+     * @return false if the range is not usable or an entry could not be 
+     *          indexed
+     */
+    bool mount(void);
+
+    /*
+     * Erase the range, dropping all keys
+     *
+     * @return true = success
+     */
+    bool format(void);
+
+    /*
+     * @param *key = key, a NUL terminated string
+     * @param *buff = pointer to destination memory buffer
+     * @param size = size of the buffer
+     * @param *len = value length, may be larger than 'size'
+     * @return false if the key is not stored
+     */
+    bool get(const char *key, uint8_t *buff, uint32_t size, uint32_t *len);
+
+    /*
+     * Store a value, replacing any earlier value for the key. Compacts 
+     * first if the free blocks have run down to the reserve.
+     *
+     * @param *key = key, a NUL terminated string
+     * @param *value = pointer to the value
+     * @param len = value length in bytes
+     * @return false if the entry is too long, the index or the flash is
+     *          full, or an erase or program failed
+     */
+    bool put(const char *key, const void *value, uint32_t len);
+
+    /*
+     * @param *key = key, a NUL terminated string
+     * @return false if the key is not stored or the entry could not be 
+     *          written
+     */
+    bool remove(const char *key);
+
+    /*
+     * Program the head page if it holds entries and wait for it
+     *
+     * @return true = all pages programmed without erase/program error
+     *          since the last failure was reported, including one first
+     *          seen by get() or mount()
+     */
+    bool sync(void);
+
+    /*
+     * Compact for up to 'budget_us', one entry at a time, while fewer 
+     * than AT45_KV_FREE blocks are free. A step may overrun the budget by
+     * one page read or program.
+     *
+     * @param budget_us = time to spend
+     * @return true if there is more compaction to do
+     */
+    bool compact(uint32_t budget_us);
+
+    /*
+     * @return number of keys stored
+     */
+    uint32_t count(void);
+
+    /*
+     * @return number of blocks the head can still enter
+     */
+    uint32_t free_blocks(void);
+
+    /*
+     * @return bytes of framing per page plus per entry
+     */
+    static uint32_t overhead(void)
+    {
+        return sizeof(page_header) + sizeof(entry_header);
+    }
+
+private:
+
+    enum KINDS {
+        KIND_PUT            = 'P',
+        KIND_REMOVE         = 'R',
+    };
+
+    struct page_header {
+        uint16_t        seq;
+        uint16_t        tail;                   // tail block when the page was started
+        uint16_t        magic;
+        uint16_t        crc;                    // of the fields above
+    };
+
+    struct entry_header {
+        uint8_t         klen;                   // FFh: erased, end of the page
+        uint8_t         kind;
+        uint16_t        vlen;
+        uint16_t        crc;                    // of the fields above, key and value
+    };
+
+    AT45DB              &_flash;
+    uint32_t            _addr;
+    uint32_t            _blocks;
+    uint32_t            _pages;
+    uint16_t            _seq0;                  // sequence number of page 0 in this lap
+    uint32_t            _page;                  // head page
+    uint32_t            _fill;                  // bytes used in the head page, 0 = not started
+    uint32_t            _tail;                  // oldest block holding live entries
+    uint32_t            _gc_page;               // page of the tail block being compacted
+    uint32_t            _gc_offset;             // next entry in it, 0 = not loaded
+    uint32_t            _count;
+    AT45DB::BUFFERS     _buffer;                // buffer for the next program
+    bool                _busy;                  // a program or erase may be in progress
+    AT45DB::OPERATIONS  _busy_op;
+    bool                _failed;                // a program or erase failed, not yet reported
+    bool                _unerased;              // the erase of the head's block failed
+    uint32_t            _slot[AT45_KV_SLOTS];
+    uint8_t             _head[AT45_PAGE_SIZE];
+    uint8_t             _gc[AT45_PAGE_SIZE];    // page being compacted or mounted
+
+    static uint32_t hash(const uint8_t *key, uint32_t klen);
+    int find(const uint8_t *key, uint32_t klen, uint32_t h, int *free);
+    bool index(const uint8_t *key, uint32_t klen, KINDS kind, uint32_t loc);
+    bool emit(KINDS kind, const uint8_t *key, uint32_t klen, const uint8_t *value, uint32_t vlen, uint32_t *loc);
+    bool compact_step(void);
+    bool compact_block(void);
+    uint32_t last_block(void);
+    bool read_header(uint32_t page, page_header *hdr);
+    bool in_lap(uint32_t page);
+    void fetch(uint32_t loc, uint8_t *buff, uint32_t size);
+    bool commit(void);
+    void wait_idle(void);
+    bool wait_busy(void);
+
+};
+
+#endif // _AT45DBKV_H_
@@ -0,0 +1,234 @@
+/* 
+ * @file    AT45DBLog.cpp
+ * @brief   Append-only record log on the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBLog.h"
+
+AT45DBLog::AT45DBLog(AT45DB &flash, uint32_t addr, uint32_t pages) :
+        _flash(flash), _addr(addr), _pages(pages), _seq0(0), _page(0), _fill(0),
+        _buffer(AT45DB::AT45_BUFFER1), _busy(false)
+{
+}
+
+AT45DBLog::~AT45DBLog() { }
+
+/*
+ * Pages are programmed in order, so the used pages are a prefix of the
+ * range: search for the first page whose header is still erased.
+ */
+bool AT45DBLog::mount(void)
+{
+    page_header     hdr;
+    uint32_t        lo, hi, mid;
+
+    _fill = 0;
+    if (!AT45DBLog::read_header(0, &hdr)) {
+        if (hdr.magic != AT45_LOG_END) {
+            return 0;
+        }
+        _page = 0;
+        return 1;
+    }
+    _seq0 = hdr.seq;
+
+    // page 'lo' is used, page 'hi' is erased or past the end
+    lo = 0;
+    hi = _pages;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        AT45DBLog::read_header(mid, &hdr);
+        if (hdr.magic == AT45_LOG_END) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    _page = hi;
+    return 1;
+}
+
+bool AT45DBLog::format(void)
+{
+    if (!AT45DBLog::wait_programmed()) {
+        return 0;
+    }
+    _seq0 += _page + (_fill ? 1 : 0);
+    _page = 0;
+    _fill = 0;
+    return _flash.at45_erase_range(_addr, _pages * _flash.at45_page_size()) == AT45DB::AT45_OK;
+}
+
+bool AT45DBLog::append(const void *rec, uint32_t len)
+{
+    record_header   rh;
+    page_header     hdr;
+
+    if (len > _flash.at45_page_size() - AT45DBLog::overhead()) {
+        return 0;
+    }
+    if (_fill && (_fill + sizeof(rh) + len > _flash.at45_page_size())) {
+        if (!AT45DBLog::commit()) {
+            return 0;
+        }
+    }
+    if (!_fill) {
+        if (_page >= _pages) {
+            return 0;
+        }
+        memset(_tail, 0xff, _flash.at45_page_size());
+        hdr.seq = _seq0 + _page;
+        hdr.magic = AT45_LOG_MAGIC;
+        hdr.crc = at45_crc16((const uint8_t *)&hdr, offsetof(page_header, crc));
+        memcpy(_tail, &hdr, sizeof(hdr));
+        _fill = sizeof(hdr);
+    }
+    rh.len = (uint16_t)len;
+    rh.crc = at45_crc16((const uint8_t *)rec, len);
+    memcpy(&_tail[_fill], &rh, sizeof(rh));
+    memcpy(&_tail[_fill + sizeof(rh)], rec, len);
+    _fill += sizeof(rh) + len;
+    return 1;
+}
+
+bool AT45DBLog::sync(void)
+{
+    if (_fill && !AT45DBLog::commit()) {
+        return 0;
+    }
+    return AT45DBLog::wait_programmed();
+}
+
+bool AT45DBLog::next(uint32_t &pos, uint8_t *buff, uint32_t size, uint32_t *len)
+{
+    uint32_t        page_size = _flash.at45_page_size();
+    uint32_t        page, offset;
+    page_header     hdr;
+    record_header   rh;
+    uint8_t         chunk[32];
+    uint32_t        n, i;
+    uint16_t        crc;
+
+    for (;;) {
+        page = pos / page_size;
+        offset = pos % page_size;
+        if ((page > _page) || ((page == _page) && (!_fill || (offset >= _fill)))) {
+            return 0;
+        }
+        if (offset == 0) {
+            // a page in flash must carry a good header with its own sequence number
+            if ((page < _page) && (!AT45DBLog::read_header(page, &hdr) || (hdr.seq != _seq0 + page))) {
+                pos += page_size;
+                continue;
+            }
+            offset = sizeof(page_header);
+            pos += offset;
+        }
+        if (offset + sizeof(rh) > page_size) {
+            pos += page_size - offset;
+            continue;
+        }
+        AT45DBLog::fetch(pos, (uint8_t *)&rh, sizeof(rh));
+        if ((rh.len == AT45_LOG_END) || (offset + sizeof(rh) + rh.len > page_size)) {
+            pos += page_size - offset;
+            continue;
+        }
+        pos += sizeof(rh);
+
+        // check the CRC over the whole record, even where it is truncated in 'buff'
+        n = (rh.len < size) ? rh.len : size;
+        AT45DBLog::fetch(pos, buff, n);
+        crc = at45_crc16(buff, n);
+        for (i=n; i<rh.len; i+=sizeof(chunk)) {
+            n = (rh.len - i < sizeof(chunk)) ? rh.len - i : sizeof(chunk);
+            AT45DBLog::fetch(pos + i, chunk, n);
+            crc = at45_crc16(chunk, n, crc);
+        }
+        pos += rh.len;
+        if (crc == rh.crc) {
+            *len = rh.len;
+            return 1;
+        }
+    }
+}
+
+uint32_t AT45DBLog::sequence(void)
+{
+    return _seq0 + _page;
+}
+
+uint32_t AT45DBLog::free_pages(void)
+{
+    return _pages - _page;
+}
+
+/*
+ * @return true if the header is valid; hdr->magic is AT45_LOG_END if
+ *          the header is erased
+ */
+bool AT45DBLog::read_header(uint32_t page, page_header *hdr)
+{
+    AT45DBLog::wait_programmed();
+    _flash.at45_read(_addr + page * _flash.at45_page_size(), (uint8_t *)hdr, sizeof(*hdr));
+    return (hdr->magic == AT45_LOG_MAGIC) && (hdr->crc == at45_crc16((const uint8_t *)hdr, offsetof(page_header, crc)));
+}
+
+/*
+ * Clock the tail page into the idle buffer, program it without erase 
+ * once the previous page has finished, and start a new tail page
+ */
+bool AT45DBLog::commit(void)
+{
+    _flash.at45_buffer_write(_buffer, 0, _tail, _flash.at45_page_size());
+    if (!AT45DBLog::wait_programmed()) {
+        return 0;
+    }
+    _flash.at45_buffer_program(_buffer, _addr + _page * _flash.at45_page_size(), false);
+    _busy = true;
+    _buffer = (_buffer == AT45DB::AT45_BUFFER1) ? AT45DB::AT45_BUFFER2 : AT45DB::AT45_BUFFER1;
+    _page++;
+    _fill = 0;
+    return 1;
+}
+
+bool AT45DBLog::wait_programmed(void)
+{
+    if (_busy) {
+        _busy = false;
+        if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_PROGRAM) != AT45DB::AT45_OK) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Copy log bytes from the RAM tail page or from flash
+ */
+void AT45DBLog::fetch(uint32_t pos, uint8_t *buff, uint32_t size)
+{
+    uint32_t    page_size = _flash.at45_page_size();
+
+    if (pos / page_size == _page) {
+        memcpy(buff, &_tail[pos % page_size], size);
+    } else {
+        AT45DBLog::wait_programmed();
+        _flash.at45_read(_addr + pos, buff, size);
+    }
+}
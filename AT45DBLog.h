@@ -0,0 +1,161 @@
+/* 
+ * @file    AT45DBLog.h
+ * @brief   Append-only record log on the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBLOG_H_
+#define _AT45DBLOG_H_
+
+#include "AT45DB.h"
+#include "AT45DBCrc.h"
+
+#define AT45_LOG_MAGIC      0x4c47              // page header marker
+#define AT45_LOG_END        0xffff              // record length read from erased flash
+
+/**
+ * Append-only log of records (sensor samples etc.) in a range of pages
+ *
+ * Records are collected in a RAM copy of the tail page. When the next 
+ * record does not fit, the tail page is clocked into an SRAM buffer and
+ * programmed without erase while appending carries on in RAM, so an 
+ * append is a memcpy and each page is programmed exactly once. The 
+ * range must be erased (format) before use.
+ *
+ * Page:    header | record | record | ... | FFh
+ * Header:  sequence number (32 bits), magic, CRC16 of the two
+ * Record:  length (16 bits), CRC16 of the data, data
+ *
+ * Sequence numbers count pages from the start of the range and carry on
+ * across format(), so they order records for the life of the object.
+ * Records do not span pages: a record is at most
+ * page size - AT45DBLog::overhead() bytes.
+ *
+ * sync() programs a partial tail page; the rest of that page is left 
+ * unused and appending continues in the next page.
+ */
+class AT45DBLog
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device holding the log
+     * @param addr = address of the first page of the log (page aligned)
+     * @param pages = number of pages in the log
+     */
+    AT45DBLog(AT45DB &flash, uint32_t addr, uint32_t pages);
+
+    ~AT45DBLog();
+
+    /*
+     * Find the end of the log by a binary search of the page headers, 
+     * so mounting reads about log2(pages) headers.
+     *
+     * @return false if the first page does not hold a log
+     */
+    bool mount(void);
+
+    /*
+     * Erase the range, dropping all records
+     *
+     * @return true = success
+     */
+    bool format(void);
+
+    /*
+     * Append a record to the RAM tail page, programming the tail page 
+     * first if the record does not fit in it.
+     *
+     * @param *rec = pointer to the record
+     * @param len = record length in bytes
+     * @return false if the record is too long, the log is full or a
+     *          page program failed
+     */
+    bool append(const void *rec, uint32_t len);
+
+    /*
+     * Program the tail page if it holds records and wait for it
+     *
+     * @return true = all pages programmed without erase/program error
+     */
+    bool sync(void);
+
+    /*
+     * Read the record at 'pos' and advance 'pos' to the next one.
+     * Start with pos = 0. Records still in the RAM tail page are 
+     * included; pages with a bad header and records with a bad CRC are
+     * skipped.
+     *
+     * @param &pos = position in the log, updated
+     * @param *buff = pointer to destination memory buffer
+     * @param size = size of the buffer
+     * @param *len = record length, may be larger than 'size'
+     * @return false at the end of the log
+     */
+    bool next(uint32_t &pos, uint8_t *buff, uint32_t size, uint32_t *len);
+
+    /*
+     * @return sequence number of the tail page
+     */
+    uint32_t sequence(void);
+
+    /*
+     * @return number of unused pages, including the tail page
+     */
+    uint32_t free_pages(void);
+
+    /*
+     * @return bytes of framing per page plus per record
+     */
+    static uint32_t overhead(void)
+    {
+        return sizeof(page_header) + sizeof(record_header);
+    }
+
+private:
+
+    struct page_header {
+        uint32_t        seq;
+        uint16_t        magic;
+        uint16_t        crc;                    // of seq and magic
+    };
+
+    struct record_header {
+        uint16_t        len;
+        uint16_t        crc;                    // of the data
+    };
+
+    AT45DB              &_flash;
+    uint32_t            _addr;
+    uint32_t            _pages;
+    uint32_t            _seq0;                  // sequence number of the first page
+    uint32_t            _page;                  // tail page, relative to the first
+    uint32_t            _fill;                  // bytes used in the tail page, 0 = not started
+    AT45DB::BUFFERS     _buffer;                // buffer for the next program
+    bool                _busy;                  // a page program may be in progress
+    uint8_t             _tail[AT45_PAGE_SIZE];
+
+    bool read_header(uint32_t page, page_header *hdr);
+    bool commit(void);
+    bool wait_programmed(void);
+    void fetch(uint32_t pos, uint8_t *buff, uint32_t size);
+
+};
+
+#endif // _AT45DBLOG_H_
@@ -0,0 +1,158 @@
+/* 
+ * @file    AT45DBMbedBus.h
+ * @brief   Device driver - AT45DB bus policy for mbed SPI and DigitalOut chip select
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+ 
+#ifndef _AT45DBMBEDBUS_H_
+#define _AT45DBMBEDBUS_H_
+ 
+#include "mbed.h"
+#include "hal/us_ticker_api.h"
+#include <stdarg.h>
+#include "AT45DBCore.h"
+
+/**
+ * AT45DBCore bus policy: mbed SPI master with CS on a DigitalOut.
+ * This is the bus behind the AT45DB typedef.
+ *
+ * The SPI object is locked for the duration of each command, so other
+ * devices may share the bus. All methods are defined here so that they
+ * inline into the driver.
+ */
+class AT45DBMbedBus
+{
+
+public:
+
+    /**
+     * @param mosi = SPI_MOSI pin
+     * @param miso = SPI_MISO pin
+     * @param sclk = SPI_CLK pin
+     * @param cs   = SPI_CS  pin
+     */
+    AT45DBMbedBus(PinName mosi, PinName miso, PinName sclk, PinName cs) :
+            _spi(mosi, miso, sclk), _cs(cs, AT45_CS_HIGH) { }
+
+    void init(uint32_t hz, uint8_t fill)
+    {
+        _cs = AT45_CS_HIGH;
+        _spi.frequency(hz);
+        _spi.set_default_write_value(fill);
+    }
+
+    AT45_INLINE void select(void)
+    {
+        _spi.lock();
+        _cs = AT45_CS_LOW;
+    }
+
+    AT45_INLINE void deselect(void)
+    {
+        _cs = AT45_CS_HIGH;
+        _spi.unlock();
+    }
+
+    /*
+     * Buffered SPI write, so the HAL clocks the whole run in one call
+     */
+    AT45_INLINE void transfer(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len)
+    {
+        _spi.write((const char *)tx, tx_len, (char *)rx, rx_len);
+    }
+
+    void wait_us(uint32_t us)
+    {
+        ::wait_us(us);
+    }
+
+    void sleep_ms(uint32_t ms)
+    {
+        ThisThread::sleep_for(ms);
+    }
+
+    void yield(void)
+    {
+        ThisThread::yield();
+    }
+
+    uint32_t now_ms(void)
+    {
+        return (uint32_t)Kernel::get_ms_count();
+    }
+
+    uint32_t now_us(void)
+    {
+        return us_ticker_read();
+    }
+
+    /*
+     * As mbed debug(): stderr, only where stdio messages are enabled
+     */
+    static void debug(const char *format, ...)
+    {
+#if DEVICE_STDIO_MESSAGES && !defined(NDEBUG)
+        va_list args;
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+#else
+        (void)format;
+#endif
+    }
+
+#if DEVICE_SPI_ASYNCH
+    AT45_INLINE void lock(void)
+    {
+        _spi.lock();
+    }
+
+    AT45_INLINE void unlock(void)
+    {
+        _spi.unlock();
+    }
+
+    AT45_INLINE void cs_low(void)
+    {
+        _cs = AT45_CS_LOW;
+    }
+
+    AT45_INLINE void cs_high(void)
+    {
+        _cs = AT45_CS_HIGH;
+    }
+
+    /*
+     * SPI::transfer (DMA where the target supports it); 'done' is
+     * called in interrupt context with the SPI event flags
+     */
+    void transfer_async(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len, 
+                        const Callback<void(int)> &done)
+    {
+        _spi.transfer<uint8_t>(tx, tx_len, rx, rx_len, done, SPI_EVENT_COMPLETE | SPI_EVENT_ERROR);
+    }
+#endif  // DEVICE_SPI_ASYNCH
+
+private:
+
+    SPI             _spi;
+    DigitalOut      _cs;
+
+};
+
+#endif // _AT45DBMBEDBUS_H_
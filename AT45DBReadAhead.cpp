@@ -0,0 +1,295 @@
+/* 
+ * @file    AT45DBReadAhead.cpp
+ * @brief   Adesto AT45DB sequential read-ahead prefetcher
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBReadAhead.h"
+
+/*
+ * The consumer and the worker share the ring under one mutex. The 
+ * consumer queues pages (SLOT_WANTED) ahead of its position, the worker
+ * loads them outside the lock (SLOT_LOADING) and publishes them 
+ * (SLOT_READY). Slots behind the consumer are recycled. The driver 
+ * keeps state of its own (buffer residency, statistics), so the direct
+ * reads by the consumer and the worker fetches take turns under a 
+ * second mutex, which is never held together with the first.
+ */
+
+AT45DBReadAhead::AT45DBReadAhead(AT45DB &flash) :
+        _flash(flash), _thread(NULL), _cond(_mutex),
+        _running(false), _gen(0), _last(AT45_NO_PAGE), _next(0), _streak(0), _depth(1),
+        _fetch_us(0), _gap_us(0), _then_us(0), _hits(0), _stalls(0)
+{
+    uint32_t    i;
+
+    for (i=0; i<AT45_READAHEAD_PAGES; i++) {
+        _slot[i].state = SLOT_EMPTY;
+        _slot[i].page = AT45_NO_PAGE;
+        _slot[i].gen = 0;
+    }
+}
+
+AT45DBReadAhead::~AT45DBReadAhead()
+{
+    AT45DBReadAhead::stop();
+}
+
+bool AT45DBReadAhead::start(void)
+{
+    if (_running) {
+        return 1;
+    }
+    // an mbed Thread runs once, so each start() has a new one
+    _thread = new Thread(osPriorityNormal, AT45_READAHEAD_STACK);
+    _running = true;
+    _timer.start();
+    if (_thread->start(callback(this, &AT45DBReadAhead::worker)) != osOK) {
+        _running = false;
+        delete _thread;
+        _thread = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void AT45DBReadAhead::stop(void)
+{
+    if (!_running) {
+        return;
+    }
+    _mutex.lock();
+    _running = false;
+    AT45DBReadAhead::drop();
+    _cond.notify_all();
+    _mutex.unlock();
+    _thread->join();
+    delete _thread;
+    _thread = NULL;
+    _timer.stop();
+}
+
+bool AT45DBReadAhead::read(uint32_t addr, uint8_t *buff, uint32_t size)
+{
+    uint32_t    offset, n;
+
+    while (size > 0) {
+        offset = addr % _flash.at45_page_size();
+        n = _flash.at45_page_size() - offset;
+        if (n > size) {
+            n = size;
+        }
+        if (!AT45DBReadAhead::read_page(addr - offset, offset, buff, n)) {
+            return 0;
+        }
+        addr += n;
+        buff += n;
+        size -= n;
+    }
+    return 1;
+}
+
+uint32_t AT45DBReadAhead::depth(void)
+{
+    return _depth;
+}
+
+uint32_t AT45DBReadAhead::hits(void)
+{
+    return _hits;
+}
+
+uint32_t AT45DBReadAhead::stalls(void)
+{
+    return _stalls;
+}
+
+bool AT45DBReadAhead::read_page(uint32_t page, uint32_t offset, uint8_t *buff, uint32_t size)
+{
+    uint32_t    now_us;
+    int         i;
+
+    _mutex.lock();
+    if (page != _last) {
+        // measure the consumer: time between moving on to a new page
+        now_us = _timer.read_us();
+        if (_last != AT45_NO_PAGE) {
+            _gap_us += ((int32_t)(now_us - _then_us) - (int32_t)_gap_us) / 4;
+        }
+        _then_us = now_us;
+
+        if ((_last != AT45_NO_PAGE) && (page == _last + _flash.at45_page_size())) {
+            _streak++;
+        } else {
+            _streak = 0;
+            AT45DBReadAhead::drop();
+        }
+        _last = page;
+        AT45DBReadAhead::adapt();
+        if (_running && (_streak > 0)) {
+            AT45DBReadAhead::refill();
+        }
+    }
+
+    i = AT45DBReadAhead::find(page);
+    if ((i >= 0) && (_slot[i].state == SLOT_READY)) {
+        _hits++;
+    } else {
+        _stalls++;
+        // wait for a fetch already under way, otherwise read it here
+        while ((i >= 0) && (_slot[i].state != SLOT_READY)) {
+            _cond.wait();
+            i = AT45DBReadAhead::find(page);
+        }
+        if ((i < 0) || (_slot[i].state != SLOT_READY)) {
+            _mutex.unlock();
+            return AT45DBReadAhead::fetch(page + offset, buff, size);
+        }
+    }
+    memcpy(buff, &_slot[i].data[offset], size);
+    _mutex.unlock();
+    return 1;
+}
+
+/*
+ * depth = consumer reads per page fetch, rounded up, plus one
+ */
+void AT45DBReadAhead::adapt(void)
+{
+    uint32_t    depth = 1;
+
+    if ((_fetch_us > 0) && (_gap_us > 0)) {
+        depth = (_fetch_us + _gap_us - 1) / _gap_us + 1;
+    }
+    if (depth > AT45_READAHEAD_PAGES) {
+        depth = AT45_READAHEAD_PAGES;
+    }
+    _depth = depth;
+}
+
+/*
+ * Recycle slots behind the consumer and queue pages up to 'depth' ahead
+ */
+void AT45DBReadAhead::refill(void)
+{
+    uint32_t    i;
+    bool        queued = false;
+
+    if (_next <= _last) {
+        _next = _last + _flash.at45_page_size();
+    }
+    for (i=0; i<AT45_READAHEAD_PAGES; i++) {
+        if ((_slot[i].state == SLOT_READY) && (_slot[i].page < _last)) {
+            _slot[i].state = SLOT_EMPTY;
+        }
+    }
+    while (_next <= _last + _depth * _flash.at45_page_size()) {
+        for (i=0; i<AT45_READAHEAD_PAGES; i++) {
+            if (_slot[i].state == SLOT_EMPTY) {
+                break;
+            }
+        }
+        if (i == AT45_READAHEAD_PAGES) {
+            break;
+        }
+        _slot[i].page = _next;
+        _slot[i].gen = _gen;
+        _slot[i].state = SLOT_WANTED;
+        _next += _flash.at45_page_size();
+        queued = true;
+    }
+    if (queued) {
+        _cond.notify_all();
+    }
+}
+
+/*
+ * Forget the stream. Slots being loaded are left to the worker,
+ * which discards them because the generation has moved on.
+ */
+void AT45DBReadAhead::drop(void)
+{
+    uint32_t    i;
+
+    _gen++;
+    _next = 0;
+    for (i=0; i<AT45_READAHEAD_PAGES; i++) {
+        if (_slot[i].state != SLOT_LOADING) {
+            _slot[i].state = SLOT_EMPTY;
+        }
+    }
+}
+
+int AT45DBReadAhead::find(uint32_t page)
+{
+    uint32_t    i;
+
+    for (i=0; i<AT45_READAHEAD_PAGES; i++) {
+        if ((_slot[i].state != SLOT_EMPTY) && (_slot[i].page == page) && (_slot[i].gen == _gen)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void AT45DBReadAhead::worker(void)
+{
+    uint32_t    i, j, gen, start_us, took_us;
+
+    _mutex.lock();
+    while (_running) {
+        // nearest wanted page first, i.e. the lowest address
+        gen = _gen;
+        i = AT45_READAHEAD_PAGES;
+        for (j=0; j<AT45_READAHEAD_PAGES; j++) {
+            if ((_slot[j].state == SLOT_WANTED) && 
+                ((i == AT45_READAHEAD_PAGES) || (_slot[j].page < _slot[i].page))) {
+                i = j;
+            }
+        }
+        if (i == AT45_READAHEAD_PAGES) {
+            _cond.wait();
+            continue;
+        }
+        _slot[i].state = SLOT_LOADING;
+        _mutex.unlock();
+
+        start_us = _timer.read_us();
+        AT45DBReadAhead::fetch(_slot[i].page, _slot[i].data, _flash.at45_page_size());
+        took_us = _timer.read_us() - start_us;
+
+        _mutex.lock();
+        _fetch_us += ((int32_t)took_us - (int32_t)_fetch_us) / 4;
+        _slot[i].state = (_slot[i].gen == gen) && (gen == _gen) ? SLOT_READY : SLOT_EMPTY;
+        _cond.notify_all();
+    }
+    _mutex.unlock();
+}
+
+/*
+ * Read from flash, one driver call at a time
+ */
+bool AT45DBReadAhead::fetch(uint32_t addr, uint8_t *buff, uint32_t size)
+{
+    bool        ok;
+
+    _flash_mutex.lock();
+    ok = _flash.at45_read(addr, buff, size);
+    _flash_mutex.unlock();
+    return ok;
+}
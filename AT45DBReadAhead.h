@@ -0,0 +1,143 @@
+/* 
+ * @file    AT45DBReadAhead.h
+ * @brief   Adesto AT45DB sequential read-ahead prefetcher
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBREADAHEAD_H_
+#define _AT45DBREADAHEAD_H_
+
+#include "AT45DB.h"
+
+#ifndef AT45_READAHEAD_PAGES
+#define AT45_READAHEAD_PAGES    4               // maximum prefetch depth (RAM pages in the ring)
+#endif  // AT45_READAHEAD_PAGES
+
+#ifndef AT45_READAHEAD_STACK
+#define AT45_READAHEAD_STACK    1024            // worker thread stack size
+#endif  // AT45_READAHEAD_STACK
+
+/**
+ * Sequential read-ahead for replaying data page by page
+ *
+ * Once two consecutive page reads have been seen, a worker thread 
+ * fetches the following pages into a small ring of RAM pages so the 
+ * next read() finds its page already loaded. The prefetch depth tracks
+ * the consumer: it is the number of consumer reads made in the time one
+ * page fetch takes, rounded up, plus one, limited to the ring size.
+ * A read that is not sequential drops the ring and is read directly.
+ *
+ * Intended for read-only replay: while read-ahead is running the worker
+ * thread uses the driver, so the driver must not be used directly (by 
+ * any thread) until stop() has returned; read through read() instead.
+ */
+class AT45DBReadAhead
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device to read from
+     */
+    AT45DBReadAhead(AT45DB &flash);
+
+    ~AT45DBReadAhead();
+
+    /*
+     * Start the worker thread. It may be started again after stop().
+     *
+     * @return true = success
+     */
+    bool start(void);
+
+    /*
+     * Stop the worker thread and drop any prefetched pages
+     */
+    void stop(void);
+
+    /*
+     * Read data, from the ring where the pages have been prefetched.
+     *
+     * @param addr = address in flash from which to start reading
+     * @param *buff = pointer to destination memory buffer
+     * @param size = number of bytes to read
+     * @return true = success
+     */
+    bool read(uint32_t addr, uint8_t *buff, uint32_t size);
+
+    /*
+     * @return current prefetch depth in pages
+     */
+    uint32_t depth(void);
+
+    /*
+     * @return number of page reads served from the ring
+     */
+    uint32_t hits(void);
+
+    /*
+     * @return number of page reads that had to wait for or do a fetch
+     */
+    uint32_t stalls(void);
+
+private:
+
+    enum SLOTSTATE {
+        SLOT_EMPTY,
+        SLOT_WANTED,                            // queued for the worker
+        SLOT_LOADING,                           // being read by the worker
+        SLOT_READY,
+    };
+
+    struct slot {
+        uint32_t        page;
+        SLOTSTATE       state;
+        uint32_t        gen;                    // stream generation it was queued for
+        uint8_t         data[AT45_PAGE_SIZE];
+    };
+
+    AT45DB              &_flash;
+    Thread              *_thread;               // worker, created by start() and deleted by stop()
+    Mutex               _mutex;
+    Mutex               _flash_mutex;           // driver calls by the consumer and the worker
+    ConditionVariable   _cond;
+    Timer               _timer;
+    bool                _running;
+    uint32_t            _gen;                   // bumped when the stream is broken
+    uint32_t            _last;                  // last page read by the consumer
+    uint32_t            _next;                  // next page to queue for prefetch
+    uint32_t            _streak;                // consecutive sequential page reads
+    uint32_t            _depth;
+    uint32_t            _fetch_us;              // average page fetch time
+    uint32_t            _gap_us;                // average time between consumer reads
+    uint32_t            _then_us;               // time of the previous consumer read
+    uint32_t            _hits;
+    uint32_t            _stalls;
+    struct slot         _slot[AT45_READAHEAD_PAGES];
+
+    void worker(void);
+    int find(uint32_t page);
+    void drop(void);
+    void refill(void);
+    void adapt(void);
+    bool read_page(uint32_t page, uint32_t offset, uint8_t *buff, uint32_t size);
+    bool fetch(uint32_t addr, uint8_t *buff, uint32_t size);
+
+};
+
+#endif // _AT45DBREADAHEAD_H_
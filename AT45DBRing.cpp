@@ -0,0 +1,345 @@
+/* 
+ * @file    AT45DBRing.cpp
+ * @brief   Circular record log on the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBRing.h"
+
+AT45DBRing::AT45DBRing(AT45DB &flash, uint32_t addr, uint32_t blocks) :
+        _flash(flash), _addr(addr), _pages(blocks * flash.at45_block_pages()), _seq0(0), 
+        _page(0), _fill(0), _wrapped(false), _buffer(AT45DB::AT45_BUFFER1), _busy(false),
+        _busy_op(AT45DB::AT45_OP_PROGRAM), _failed(false), _unerased(false)
+{
+}
+
+AT45DBRing::~AT45DBRing() { }
+
+/*
+ * Page 0 gives the sequence number of the current lap; the pages in the
+ * lap are a prefix of the range, so the head is found by binary search.
+ * If page 0 is erased (or torn) the head is page 0 and the lap before
+ * ended at the last page. The pages from the head to the end of its 
+ * block are erased, unless the head is at the start of a block; past 
+ * that the previous lap continues if the log has wrapped.
+ */
+bool AT45DBRing::mount(void)
+{
+    uint32_t        bp = _flash.at45_block_pages();
+    page_header     hdr;
+    uint32_t        lo, hi, mid, t;
+
+    if ((_pages < 2 * bp) || (_pages > 0x8000)) {
+        return 0;
+    }
+    _fill = 0;
+    _wrapped = false;
+    if (AT45DBRing::read_header(0, &hdr)) {
+        _seq0 = hdr.seq;
+        // page 'lo' is in this lap, page 'hi' is not or is past the end
+        lo = 0;
+        hi = _pages;
+        while (hi - lo > 1) {
+            mid = lo + (hi - lo) / 2;
+            if (AT45DBRing::in_lap(mid)) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        _page = hi;
+        // a page torn by a power failure cannot be programmed again
+        while ((_page < _pages) && (_page % bp)) {
+            if (!AT45DBRing::read_header(_page, &hdr) && (hdr.magic == AT45_RING_END)) {
+                break;
+            }
+            _page++;
+        }
+        if (_page == _pages) {
+            _page = 0;
+            _seq0 = (uint16_t)(_seq0 + _pages);
+            _wrapped = true;
+        } else {
+            // the previous lap resumes at the next block, or at the head's
+            // own block if its erase has not started
+            t = (_page % bp) ? (_page / bp + 1) * bp : _page;
+            _wrapped = (t < _pages) && AT45DBRing::read_header(t, &hdr);
+            if (!_wrapped && (t == _page) && (hdr.magic == AT45_RING_END) && (t + bp < _pages)) {
+                _wrapped = AT45DBRing::read_header(t + bp, &hdr);
+            }
+        }
+    } else {
+        _page = 0;
+        if (AT45DBRing::read_header(_pages - 1, &hdr)) {
+            _seq0 = (uint16_t)(hdr.seq + 1);
+            _wrapped = true;
+        }
+    }
+    return 1;
+}
+
+bool AT45DBRing::format(void)
+{
+    if (!AT45DBRing::wait_busy()) {
+        return 0;
+    }
+    _seq0 = (uint16_t)(_seq0 + _page + (_fill ? 1 : 0));
+    _page = 0;
+    _fill = 0;
+    _wrapped = false;
+    _unerased = false;
+    return _flash.at45_erase_range(_addr, _pages * _flash.at45_page_size()) == AT45DB::AT45_OK;
+}
+
+bool AT45DBRing::append(const void *rec, uint32_t len)
+{
+    uint32_t        page_size = _flash.at45_page_size();
+    record_header   rh;
+    page_header     hdr;
+
+    if (len > page_size - AT45DBRing::overhead()) {
+        return 0;
+    }
+    if (_fill && (_fill + sizeof(rh) + len > page_size)) {
+        if (!AT45DBRing::commit()) {
+            return 0;
+        }
+    }
+    if (!_fill) {
+        if ((_page % _flash.at45_block_pages()) == 0) {
+            // entering a block: erase it while the page fills in RAM
+            if (!AT45DBRing::wait_busy()) {
+                return 0;
+            }
+            _flash.at45_eraseblock(_addr + _page * page_size);
+            _busy = true;
+            _busy_op = AT45DB::AT45_OP_BLOCK_ERASE;
+        }
+        memset(_head, 0xff, page_size);
+        hdr.seq = (uint16_t)(_seq0 + _page);
+        hdr.magic = AT45_RING_MAGIC;
+        hdr.crc = at45_crc16((const uint8_t *)&hdr, offsetof(page_header, crc));
+        memcpy(_head, &hdr, sizeof(hdr));
+        _fill = sizeof(hdr);
+    }
+    rh.len = (uint16_t)len;
+    rh.crc = at45_crc16((const uint8_t *)rec, len);
+    memcpy(&_head[_fill], &rh, sizeof(rh));
+    memcpy(&_head[_fill + sizeof(rh)], rec, len);
+    _fill += sizeof(rh) + len;
+    return 1;
+}
+
+bool AT45DBRing::sync(void)
+{
+    if (_fill && !AT45DBRing::commit()) {
+        return 0;
+    }
+    return AT45DBRing::wait_busy();
+}
+
+bool AT45DBRing::next(uint32_t &pos, uint8_t *buff, uint32_t size, uint32_t *len)
+{
+    uint32_t        page_size = _flash.at45_page_size();
+    uint32_t        used = AT45DBRing::used_pages();
+    uint32_t        lp, page, offset;
+    page_header     hdr;
+    record_header   rh;
+    uint8_t         chunk[32];
+    uint32_t        n, i;
+    uint16_t        crc;
+    bool            ram;
+
+    for (;;) {
+        lp = pos / page_size;
+        offset = pos % page_size;
+        if ((lp > used) || ((lp == used) && (!_fill || (offset >= _fill)))) {
+            return 0;
+        }
+        page = (AT45DBRing::tail() + lp) % _pages;
+        ram = (lp == used);
+        if (offset == 0) {
+            if (!ram && !AT45DBRing::read_header(page, &hdr)) {
+                pos += page_size;
+                continue;
+            }
+            offset = sizeof(page_header);
+            pos += offset;
+        }
+        if (offset + sizeof(rh) > page_size) {
+            pos += page_size - offset;
+            continue;
+        }
+        AT45DBRing::fetch(page, offset, (uint8_t *)&rh, sizeof(rh), ram);
+        if ((rh.len == AT45_RING_END) || (offset + sizeof(rh) + rh.len > page_size)) {
+            pos += page_size - offset;
+            continue;
+        }
+        offset += sizeof(rh);
+        pos += sizeof(rh);
+
+        // check the CRC over the whole record, even where it is truncated in 'buff'
+        n = (rh.len < size) ? rh.len : size;
+        AT45DBRing::fetch(page, offset, buff, n, ram);
+        crc = at45_crc16(buff, n);
+        for (i=n; i<rh.len; i+=sizeof(chunk)) {
+            n = (rh.len - i < sizeof(chunk)) ? rh.len - i : sizeof(chunk);
+            AT45DBRing::fetch(page, offset + i, chunk, n, ram);
+            crc = at45_crc16(chunk, n, crc);
+        }
+        pos += rh.len;
+        if (crc == rh.crc) {
+            *len = rh.len;
+            return 1;
+        }
+    }
+}
+
+uint32_t AT45DBRing::head(void)
+{
+    return _page;
+}
+
+/*
+ * With the head's block not yet erased the oldest page is the head 
+ * itself, otherwise the start of the next block
+ */
+uint32_t AT45DBRing::tail(void)
+{
+    uint32_t    bp = _flash.at45_block_pages();
+
+    if (!_wrapped) {
+        return 0;
+    }
+    if (((_page % bp) == 0) && !_fill) {
+        return _page;
+    }
+    return ((_page / bp + 1) * bp) % _pages;
+}
+
+/*
+ * @return true if the header is valid; hdr->magic is AT45_RING_END if
+ *          the header is erased
+ */
+bool AT45DBRing::read_header(uint32_t page, page_header *hdr)
+{
+    AT45DBRing::wait_idle();
+    _flash.at45_read(_addr + page * _flash.at45_page_size(), (uint8_t *)hdr, sizeof(*hdr));
+    return (hdr->magic == AT45_RING_MAGIC) && (hdr->crc == at45_crc16((const uint8_t *)hdr, offsetof(page_header, crc)));
+}
+
+/*
+ * Pages of the previous lap hold seq(0) + p - pages, which is never 
+ * seq(0) + p modulo 2^16 since there are at most 2^15 pages
+ */
+bool AT45DBRing::in_lap(uint32_t page)
+{
+    page_header     hdr;
+
+    return AT45DBRing::read_header(page, &hdr) && (hdr.seq == (uint16_t)(_seq0 + page));
+}
+
+/*
+ * @return number of pages in flash from the tail up to the head
+ */
+uint32_t AT45DBRing::used_pages(void)
+{
+    uint32_t    t = AT45DBRing::tail();
+
+    if ((t == _page) && _wrapped && !_fill) {
+        return _pages;
+    }
+    return (_page + _pages - t) % _pages;
+}
+
+/*
+ * Clock the head page into the idle buffer, program it without erase 
+ * once the previous operation has finished, and move the head on. If
+ * the erase of the head's block failed the block is erased again first;
+ * programming without erase over it would corrupt the page.
+ */
+bool AT45DBRing::commit(void)
+{
+    _flash.at45_buffer_write(_buffer, 0, _head, _flash.at45_page_size());
+    if (!AT45DBRing::wait_busy()) {
+        return 0;
+    }
+    if (_unerased) {
+        _unerased = false;
+        _flash.at45_eraseblock(_addr + _page * _flash.at45_page_size());
+        _busy = true;
+        _busy_op = AT45DB::AT45_OP_BLOCK_ERASE;
+        if (!AT45DBRing::wait_busy()) {
+            return 0;
+        }
+    }
+    _flash.at45_buffer_program(_buffer, _addr + _page * _flash.at45_page_size(), false);
+    _busy = true;
+    _busy_op = AT45DB::AT45_OP_PROGRAM;
+    _buffer = (_buffer == AT45DB::AT45_BUFFER1) ? AT45DB::AT45_BUFFER2 : AT45DB::AT45_BUFFER1;
+    _fill = 0;
+    if (++_page == _pages) {
+        _page = 0;
+        _seq0 = (uint16_t)(_seq0 + _pages);
+        _wrapped = true;
+    }
+    return 1;
+}
+
+/*
+ * Wait for the program or erase in progress and record a failure, which
+ * stays set until wait_busy() reports it
+ */
+void AT45DBRing::wait_idle(void)
+{
+    if (_busy) {
+        _busy = false;
+        if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, _busy_op) != AT45DB::AT45_OK) {
+            _failed = true;
+            if (_busy_op == AT45DB::AT45_OP_BLOCK_ERASE) {
+                _unerased = true;
+            }
+        }
+    }
+}
+
+/*
+ * @return false if a program or erase has failed since the last report
+ */
+bool AT45DBRing::wait_busy(void)
+{
+    AT45DBRing::wait_idle();
+    if (_failed) {
+        _failed = false;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Copy log bytes from the RAM head page or from flash
+ */
+void AT45DBRing::fetch(uint32_t page, uint32_t offset, uint8_t *buff, uint32_t size, bool ram)
+{
+    if (ram) {
+        memcpy(buff, &_head[offset], size);
+    } else {
+        AT45DBRing::wait_idle();
+        _flash.at45_read(_addr + page * _flash.at45_page_size() + offset, buff, size);
+    }
+}
@@ -0,0 +1,163 @@
+/* 
+ * @file    AT45DBRing.h
+ * @brief   Circular record log on the Adesto AT45DB
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBRING_H_
+#define _AT45DBRING_H_
+
+#include "AT45DB.h"
+#include "AT45DBCrc.h"
+
+#define AT45_RING_MAGIC     0x5247              // page header marker
+#define AT45_RING_END       0xffff              // record length or header field read from erased flash
+
+/**
+ * Circular log of records in a range of blocks: once full, the oldest 
+ * block is erased to make room
+ *
+ * Records are framed as in AT45DBLog (length, CRC16, data; no spanning 
+ * pages) and collected in a RAM copy of the head page, which is 
+ * programmed without erase when full. A block is erased when the head 
+ * first enters it, while the head page is still filling in RAM.
+ *
+ * Each page header holds a 16 bit sequence number that wraps. Pages are
+ * written in address order, so in the current lap page p holds sequence
+ * number seq(0) + p, and older pages do not. mount() reads the header 
+ * of page 0 and binary searches for the first page that does not, which
+ * is the head, then checks the head page and the block past it: about
+ * log2(pages) + 3 header reads, 15 for 4096 pages.
+ */
+class AT45DBRing
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device holding the log
+     * @param addr = address of the first block of the log (block aligned)
+     * @param blocks = number of blocks in the log, at least 2
+     */
+    AT45DBRing(AT45DB &flash, uint32_t addr, uint32_t blocks);
+
+    ~AT45DBRing();
+
+    /*
+     * Find the head and tail of the log from the page headers
+     *
+     * @return true = success
+     */
+    bool mount(void);
+
+    /*
+     * Erase the range, dropping all records
+     *
+     * @return true = success
+     */
+    bool format(void);
+
+    /*
+     * Append a record to the RAM head page, programming the head page 
+     * first if the record does not fit in it. Starting a page at the 
+     * start of a block erases that block, dropping its records.
+     *
+     * @param *rec = pointer to the record
+     * @param len = record length in bytes
+     * @return false if the record is too long or an erase or program 
+     *          failed, including one first seen by next() or mount()
+     */
+    bool append(const void *rec, uint32_t len);
+
+    /*
+     * Program the head page if it holds records and wait for it
+     *
+     * @return true = all pages programmed without erase/program error
+     *          since the last failure was reported
+     */
+    bool sync(void);
+
+    /*
+     * Read the record at 'pos', oldest first, and advance 'pos' to the 
+     * next one. Start with pos = 0. 'pos' counts from the oldest page, so
+     * an append that erases a block moves the records under it.
+     *
+     * @param &pos = position in the log, updated
+     * @param *buff = pointer to destination memory buffer
+     * @param size = size of the buffer
+     * @param *len = record length, may be larger than 'size'
+     * @return false at the end of the log
+     */
+    bool next(uint32_t &pos, uint8_t *buff, uint32_t size, uint32_t *len);
+
+    /*
+     * @return page offset of the head page in the range
+     */
+    uint32_t head(void);
+
+    /*
+     * @return page offset of the oldest page in the range
+     */
+    uint32_t tail(void);
+
+    /*
+     * @return bytes of framing per page plus per record
+     */
+    static uint32_t overhead(void)
+    {
+        return sizeof(page_header) + sizeof(record_header);
+    }
+
+private:
+
+    struct page_header {
+        uint16_t        seq;
+        uint16_t        magic;
+        uint16_t        crc;                    // of seq and magic
+    };
+
+    struct record_header {
+        uint16_t        len;
+        uint16_t        crc;                    // of the data
+    };
+
+    AT45DB              &_flash;
+    uint32_t            _addr;
+    uint32_t            _pages;
+    uint16_t            _seq0;                  // sequence number of page 0 in this lap
+    uint32_t            _page;                  // head page
+    uint32_t            _fill;                  // bytes used in the head page, 0 = not started
+    bool                _wrapped;               // pages past the head hold the previous lap
+    AT45DB::BUFFERS     _buffer;                // buffer for the next program
+    bool                _busy;                  // a program or erase may be in progress
+    AT45DB::OPERATIONS  _busy_op;
+    bool                _failed;                // a program or erase failed, not yet reported
+    bool                _unerased;              // the erase of the head's block failed
+    uint8_t             _head[AT45_PAGE_SIZE];
+
+    bool read_header(uint32_t page, page_header *hdr);
+    bool in_lap(uint32_t page);
+    uint32_t used_pages(void);
+    bool commit(void);
+    void wait_idle(void);
+    bool wait_busy(void);
+    void fetch(uint32_t page, uint32_t offset, uint8_t *buff, uint32_t size, bool ram);
+
+};
+
+#endif // _AT45DBRING_H_
@@ -0,0 +1,463 @@
+/* 
+ * @file    AT45DBSim.cpp
+ * @brief   Host-side Adesto AT45DB161E chip simulator
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBSim.h"
+#include <string.h>
+
+/*
+ * Device constants (AT45DB161E)
+ */
+#define SIM_PAGES           4096
+#define SIM_PAGE_528        528
+#define SIM_PAGE_BINARY     512
+#define SIM_BLOCK_PAGES     8
+#define SIM_SECTOR_PAGES    256
+#define SIM_DENSITY         0x2C                // status byte1 bits 5-2 for 16Mbit
+#define SIM_PS_PER_US       1000000ULL
+
+/*
+ * Typical operation times in microseconds, as used by the driver
+ */
+#define SIM_T_XFR           100                 // page to buffer transfer / compare
+#define SIM_T_P             2000                // page program
+#define SIM_T_EP            12000               // page erase and program
+#define SIM_T_PE            8000                // page erase
+#define SIM_T_BE            30000               // block erase
+#define SIM_T_SE            700000              // sector erase
+#define SIM_T_CE            22000000            // chip erase
+#define SIM_T_CFG           12000               // configuration register program
+#define SIM_T_RDPD          35                  // resume from deep power down
+#define SIM_T_XUDPD         120                 // exit ultra deep power down
+
+static const uint8_t sim_id[] = {0x1F, 0x26, 0x00, 0x01, 0x00};
+
+AT45DBSim::AT45DBSim(uint32_t spi_hz) :
+        _mem(SIM_PAGES * SIM_PAGE_528, 0xff), _erases(SIM_PAGES, 0), _programs(SIM_PAGES, 0),
+        _ignored(0), _bytes(0), _now_ps(0), _busy_until(0), _busy_buffer(-1), 
+        _binary(false), _comp(false), _epe(false), _fail_next(false),
+        _deep_pd(false), _ultra_pd(false), _phase(PHASE_IDLE), 
+        _hdr_len(0), _hdr_count(0), _page(0), _offset(0), _linear(0), _data_count(0)
+{
+    memset(_buffer, 0xff, sizeof(_buffer));
+    memset(_commands, 0, sizeof(_commands));
+    memset(_hdr, 0, sizeof(_hdr));
+    AT45DBSim::frequency(spi_hz);
+}
+
+AT45DBSim::~AT45DBSim() { }
+
+void AT45DBSim::frequency(uint32_t spi_hz)
+{
+    _period_ps = 1000000000000ULL / spi_hz;
+}
+
+uint64_t AT45DBSim::now_ns(void) const
+{
+    return _now_ps / 1000;
+}
+
+void AT45DBSim::advance_ns(uint64_t ns)
+{
+    _now_ps += ns * 1000;
+}
+
+void AT45DBSim::power_cycle(void)
+{
+    memset(_buffer, 0xff, sizeof(_buffer));
+    _deep_pd = false;
+    _ultra_pd = false;
+    _comp = false;
+    _epe = false;
+    _busy_until = _now_ps;
+    _busy_buffer = -1;
+    _phase = PHASE_IDLE;
+}
+
+void AT45DBSim::fail_next_operation(void)
+{
+    _fail_next = true;
+}
+
+bool AT45DBSim::busy(void) const
+{
+    return _now_ps < _busy_until;
+}
+
+bool AT45DBSim::binary_page(void) const
+{
+    return _binary;
+}
+
+uint32_t AT45DBSim::page_size(void) const
+{
+    return _binary ? SIM_PAGE_BINARY : SIM_PAGE_528;
+}
+
+uint32_t AT45DBSim::page_count(void) const
+{
+    return SIM_PAGES;
+}
+
+const uint8_t *AT45DBSim::page_data(uint32_t page) const
+{
+    return &_mem[(page % SIM_PAGES) * SIM_PAGE_528];
+}
+
+uint32_t AT45DBSim::erase_count(uint32_t page) const
+{
+    return _erases[page % SIM_PAGES];
+}
+
+uint32_t AT45DBSim::program_count(uint32_t page) const
+{
+    return _programs[page % SIM_PAGES];
+}
+
+uint32_t AT45DBSim::command_count(uint8_t opcode) const
+{
+    return _commands[opcode];
+}
+
+uint32_t AT45DBSim::ignored_count(void) const
+{
+    return _ignored;
+}
+
+uint64_t AT45DBSim::bytes_clocked(void) const
+{
+    return _bytes;
+}
+
+/*
+ * A falling CS edge starts a command. Any CS activity wakes the device 
+ * from ultra deep power down; that command itself is not accepted.
+ */
+void AT45DBSim::select(void)
+{
+    _hdr_count = 0;
+    _data_count = 0;
+    _phase = PHASE_HEADER;
+    if (_ultra_pd) {
+        _ultra_pd = false;
+        memset(_buffer, 0xff, sizeof(_buffer));      // buffer contents are lost
+        AT45DBSim::start_operation(SIM_T_XUDPD, -1);
+        _phase = PHASE_IGNORE;
+    }
+}
+
+/*
+ * A rising CS edge starts any internally timed operation
+ */
+void AT45DBSim::deselect(void)
+{
+    if ((_phase == PHASE_DATA) || ((_phase == PHASE_HEADER) && (_hdr_count > 0) && (_hdr_count == _hdr_len))) {
+        AT45DBSim::execute();
+    }
+    _phase = PHASE_IDLE;
+}
+
+uint8_t AT45DBSim::transfer(uint8_t mosi)
+{
+    uint8_t     opcode;
+
+    _now_ps += 8 * _period_ps;
+    _bytes++;
+
+    switch (_phase) {
+    case PHASE_HEADER:
+        _hdr[_hdr_count++] = mosi;
+        if (_hdr_count == 1) {
+            opcode = mosi;
+            _commands[opcode]++;
+            _hdr_len = AT45DBSim::header_length(opcode);
+            if ((_deep_pd && (opcode != 0xAB)) ||
+                (AT45DBSim::busy() && !AT45DBSim::allowed_while_busy(opcode))) {
+                _ignored++;
+                _phase = PHASE_IGNORE;
+                return 0xff;
+            }
+        }
+        if (_hdr_count == _hdr_len) {
+            AT45DBSim::start_data();
+        }
+        return 0xff;
+
+    case PHASE_DATA:
+        return AT45DBSim::data_byte(mosi);
+
+    default:
+        return 0xff;
+    }
+}
+
+void AT45DBSim::transfer(const uint8_t *tx, uint8_t *rx, size_t len, uint8_t fill)
+{
+    size_t      i;
+    uint8_t     miso;
+
+    for (i=0; i<len; i++) {
+        miso = AT45DBSim::transfer(tx ? tx[i] : fill);
+        if (rx) {
+            rx[i] = miso;
+        }
+    }
+}
+
+/*
+ * Opcode + address + dummy bytes before the data phase
+ */
+uint32_t AT45DBSim::header_length(uint8_t opcode) const
+{
+    switch (opcode) {
+    case 0xD2:                                  // main memory page read
+    case 0xE8:                                  // continuous read (legacy)
+        return 8;
+    case 0x0B:                                  // continuous read
+    case 0xD4: case 0xD6:                       // buffer read (serial)
+    case 0x54: case 0x56:                       // buffer read (8-bit)
+        return 5;
+    case 0x03: case 0x01:                       // continuous read (low frequency / low power)
+    case 0xD1: case 0xD3:                       // buffer read (low frequency)
+    case 0x84: case 0x87:                       // buffer write
+    case 0x82: case 0x85:                       // page program through buffer
+    case 0x83: case 0x86:                       // buffer to main memory with erase
+    case 0x88: case 0x89:                       // buffer to main memory without erase
+    case 0x81: case 0x50: case 0x7C:            // page, block, sector erase
+    case 0x53: case 0x55:                       // page to buffer transfer
+    case 0x60: case 0x61:                       // page to buffer compare
+    case 0x58: case 0x59:                       // auto page rewrite
+    case 0xC7:                                  // chip erase (C7h 94h 80h 9Ah)
+    case 0x3D:                                  // page size configuration (3Dh 2Ah 80h A6h/A7h)
+        return 4;
+    default:                                    // D7h, 9Fh, B9h, ABh, 79h and unknown
+        return 1;
+    }
+}
+
+/*
+ * While busy the device accepts status reads and access to a buffer
+ * that the operation in progress is not using.
+ */
+bool AT45DBSim::allowed_while_busy(uint8_t opcode) const
+{
+    switch (opcode) {
+    case 0xD7:
+        return true;
+    case 0xD1: case 0xD4: case 0x54: case 0x84:
+        return _busy_buffer != 0;
+    case 0xD3: case 0xD6: case 0x56: case 0x87:
+        return _busy_buffer != 1;
+    default:
+        return false;
+    }
+}
+
+void AT45DBSim::decode_address(void)
+{
+    uint32_t    addr = ((uint32_t)_hdr[1] << 16) | ((uint32_t)_hdr[2] << 8) | _hdr[3];
+
+    if (_binary) {
+        _page = (addr >> 9) % SIM_PAGES;
+        _offset = addr & 0x1ff;
+    } else {
+        _page = (addr >> 10) % SIM_PAGES;
+        _offset = (addr & 0x3ff) % SIM_PAGE_528;
+    }
+    _linear = _page * AT45DBSim::page_size() + _offset;
+}
+
+void AT45DBSim::start_data(void)
+{
+    _phase = PHASE_DATA;
+    _offset = 0;
+    if (_hdr_len >= 4) {
+        AT45DBSim::decode_address();
+    }
+}
+
+uint8_t AT45DBSim::data_byte(uint8_t mosi)
+{
+    uint32_t    ps = AT45DBSim::page_size();
+    uint8_t     miso = 0xff;
+
+    switch (_hdr[0]) {
+    case 0xD2:                                  // wraps within the page
+        miso = AT45DBSim::page_ptr(_page)[_offset];
+        _offset = (_offset + 1) % ps;
+        break;
+    case 0xE8: case 0x0B: case 0x03: case 0x01: // runs on through the array
+        miso = AT45DBSim::page_ptr(_linear / ps)[_linear % ps];
+        _linear = (_linear + 1) % (SIM_PAGES * ps);
+        break;
+    case 0xD1: case 0xD4: case 0x54:
+        miso = _buffer[0][_offset];
+        _offset = (_offset + 1) % ps;
+        break;
+    case 0xD3: case 0xD6: case 0x56:
+        miso = _buffer[1][_offset];
+        _offset = (_offset + 1) % ps;
+        break;
+    case 0x84: case 0x82:
+        _buffer[0][_offset] = mosi;
+        _offset = (_offset + 1) % ps;
+        break;
+    case 0x87: case 0x85:
+        _buffer[1][_offset] = mosi;
+        _offset = (_offset + 1) % ps;
+        break;
+    case 0xD7:                                  // byte1, byte2, byte1, ...
+        miso = AT45DBSim::status_byte(_data_count & 1);
+        break;
+    case 0x9F:
+        miso = (_data_count < sizeof(sim_id)) ? sim_id[_data_count] : 0x00;
+        break;
+    default:
+        break;
+    }
+    _data_count++;
+    return miso;
+}
+
+void AT45DBSim::execute(void)
+{
+    switch (_hdr[0]) {
+    case 0x82: case 0x83: case 0x88:
+    case 0x85: case 0x86: case 0x89:
+        AT45DBSim::program_page(_page, ((_hdr[0] == 0x82) || (_hdr[0] == 0x83) || (_hdr[0] == 0x88)) ? 0 : 1,
+                                (_hdr[0] != 0x88) && (_hdr[0] != 0x89));
+        break;
+    case 0x81:
+        AT45DBSim::erase_pages(_page, 1);
+        AT45DBSim::start_operation(SIM_T_PE, -1);
+        break;
+    case 0x50:
+        AT45DBSim::erase_pages(_page & ~(SIM_BLOCK_PAGES - 1), SIM_BLOCK_PAGES);
+        AT45DBSim::start_operation(SIM_T_BE, -1);
+        break;
+    case 0x7C:
+        if (_page < SIM_BLOCK_PAGES) {
+            AT45DBSim::erase_pages(0, SIM_BLOCK_PAGES);                                 // 0a
+        } else if (_page < SIM_SECTOR_PAGES) {
+            AT45DBSim::erase_pages(SIM_BLOCK_PAGES, SIM_SECTOR_PAGES - SIM_BLOCK_PAGES); // 0b
+        } else {
+            AT45DBSim::erase_pages(_page & ~(SIM_SECTOR_PAGES - 1), SIM_SECTOR_PAGES);
+        }
+        AT45DBSim::start_operation(SIM_T_SE, -1);
+        break;
+    case 0xC7:
+        if ((_hdr[1] == 0x94) && (_hdr[2] == 0x80) && (_hdr[3] == 0x9A)) {
+            AT45DBSim::erase_pages(0, SIM_PAGES);
+            AT45DBSim::start_operation(SIM_T_CE, -1);
+        }
+        break;
+    case 0x53: case 0x55:
+        memcpy(_buffer[_hdr[0] == 0x55], AT45DBSim::page_ptr(_page), SIM_PAGE_528);
+        AT45DBSim::start_operation(SIM_T_XFR, _hdr[0] == 0x55);
+        break;
+    case 0x60: case 0x61:
+        _comp = memcmp(_buffer[_hdr[0] == 0x61], AT45DBSim::page_ptr(_page), AT45DBSim::page_size()) != 0;
+        AT45DBSim::start_operation(SIM_T_XFR, _hdr[0] == 0x61);
+        break;
+    case 0x58: case 0x59:
+        memcpy(_buffer[_hdr[0] == 0x59], AT45DBSim::page_ptr(_page), SIM_PAGE_528);
+        AT45DBSim::program_page(_page, _hdr[0] == 0x59, true);
+        break;
+    case 0x3D:
+        if ((_hdr[1] == 0x2A) && (_hdr[2] == 0x80) && ((_hdr[3] == 0xA6) || (_hdr[3] == 0xA7))) {
+            _binary = (_hdr[3] == 0xA6);
+            AT45DBSim::start_operation(SIM_T_CFG, -1);
+        }
+        break;
+    case 0xB9:
+        _deep_pd = true;
+        break;
+    case 0xAB:
+        if (_deep_pd) {
+            _deep_pd = false;
+            AT45DBSim::start_operation(SIM_T_RDPD, -1);
+        }
+        break;
+    case 0x79:
+        _ultra_pd = true;
+        break;
+    default:
+        break;
+    }
+}
+
+void AT45DBSim::start_operation(uint64_t typ_us, int buffer)
+{
+    _busy_until = _now_ps + typ_us * SIM_PS_PER_US;
+    _busy_buffer = buffer;
+}
+
+void AT45DBSim::erase_pages(uint32_t first, uint32_t count)
+{
+    uint32_t    i;
+
+    if (_fail_next) {
+        _fail_next = false;
+        _epe = true;
+        return;
+    }
+    _epe = false;
+    for (i=first; i<first+count; i++) {
+        memset(AT45DBSim::page_ptr(i), 0xff, SIM_PAGE_528);
+        _erases[i]++;
+    }
+}
+
+void AT45DBSim::program_page(uint32_t page, int buffer, bool erase)
+{
+    uint8_t     *p = AT45DBSim::page_ptr(page);
+    uint32_t    i;
+
+    AT45DBSim::start_operation(erase ? SIM_T_EP : SIM_T_P, buffer);
+    if (_fail_next) {
+        _fail_next = false;
+        _epe = true;
+        return;
+    }
+    _epe = false;
+    if (erase) {
+        memset(p, 0xff, SIM_PAGE_528);
+        _erases[page]++;
+    }
+    for (i=0; i<AT45DBSim::page_size(); i++) {
+        p[i] &= _buffer[buffer][i];
+    }
+    _programs[page]++;
+}
+
+uint8_t AT45DBSim::status_byte(int n) const
+{
+    uint8_t     rdy = AT45DBSim::busy() ? 0x00 : 0x80;
+
+    if (n == 0) {
+        return rdy | (_comp ? 0x40 : 0x00) | SIM_DENSITY | (_binary ? 0x01 : 0x00);
+    }
+    return rdy | (_epe ? 0x20 : 0x00);
+}
+
+uint8_t *AT45DBSim::page_ptr(uint32_t page)
+{
+    return &_mem[(page % SIM_PAGES) * SIM_PAGE_528];
+}
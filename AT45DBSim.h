@@ -0,0 +1,159 @@
+/* 
+ * @file    AT45DBSim.h
+ * @brief   Host-side Adesto AT45DB161E chip simulator
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBSIM_H_
+#define _AT45DBSIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Software model of an AT45DB161E for host (Linux) builds
+ *
+ * The model sits on the other side of the SPI bus: it sees chip select
+ * transitions and MOSI bytes and returns MISO bytes, and decodes every
+ * command in AT45DBTypes::CMDCODES the way the device does. It keeps:
+ *
+ *  - main memory of 4,096 pages of 528 bytes (512 visible in binary mode)
+ *  - both SRAM buffers
+ *  - the status register: ready, compare, density, page size, EPE
+ *  - the nonvolatile binary / 528 page size setting
+ *  - deep and ultra deep power down
+ *
+ * Time is modelled, not measured. Every byte clocked advances the clock
+ * by eight SPI periods, and erase, program, transfer and compare 
+ * operations keep the device busy for their datasheet typical time. 
+ * While busy, commands other than status read and access to a buffer 
+ * not in use are ignored, as on the device. Callers that wait (sleep) 
+ * advance the clock with advance_ns().
+ *
+ * Program without erase ANDs the buffer into the page, so programming
+ * a page that was not erased shows up in the data.
+ */
+class AT45DBSim
+{
+
+public:
+
+    /**
+     * @param spi_hz = SPI clock frequency used to model transfer time
+     */
+    AT45DBSim(uint32_t spi_hz = 8000000);
+
+    ~AT45DBSim();
+
+    /*
+     * Bus side: chip select and one byte full duplex transfer
+     */
+    void select(void);
+    void deselect(void);
+    uint8_t transfer(uint8_t mosi);
+
+    /*
+     * Block transfer; 'tx' may be NULL (fill is clocked out) and 'rx' 
+     * may be NULL (MISO discarded)
+     */
+    void transfer(const uint8_t *tx, uint8_t *rx, size_t len, uint8_t fill = 0x00);
+
+    /*
+     * Modelled clock
+     */
+    void frequency(uint32_t spi_hz);
+    uint64_t now_ns(void) const;
+    void advance_ns(uint64_t ns);
+
+    /*
+     * Power cycle: buffers lost, power down modes left, page size kept
+     */
+    void power_cycle(void);
+
+    /*
+     * Make the next erase or program report failure (EPE set)
+     */
+    void fail_next_operation(void);
+
+    /*
+     * Inspection for tests and benchmarks
+     */
+    bool busy(void) const;
+    bool binary_page(void) const;
+    uint32_t page_size(void) const;
+    uint32_t page_count(void) const;
+    const uint8_t *page_data(uint32_t page) const;
+    uint32_t erase_count(uint32_t page) const;
+    uint32_t program_count(uint32_t page) const;
+    uint32_t command_count(uint8_t opcode) const;
+    uint32_t ignored_count(void) const;
+    uint64_t bytes_clocked(void) const;
+
+private:
+
+    enum PHASE {
+        PHASE_IDLE,                             // CS high
+        PHASE_HEADER,                           // collecting opcode, address, dummy bytes
+        PHASE_DATA,                             // data in or out
+        PHASE_IGNORE,                           // command not accepted, wait for CS high
+    };
+
+    std::vector<uint8_t>    _mem;               // 4096 x 528
+    std::vector<uint32_t>   _erases;            // per page erase cycles
+    std::vector<uint32_t>   _programs;          // per page program cycles
+    uint8_t         _buffer[2][528];
+    uint32_t        _commands[256];
+    uint32_t        _ignored;
+    uint64_t        _bytes;
+
+    uint64_t        _period_ps;                 // SPI clock period
+    uint64_t        _now_ps;                    // modelled time
+    uint64_t        _busy_until;                // end of the operation in progress
+    int             _busy_buffer;               // buffer in use by the operation, -1 none
+    bool            _binary;                    // 512 byte pages
+    bool            _comp;                      // last compare found a difference
+    bool            _epe;                       // last erase/program failed
+    bool            _fail_next;
+    bool            _deep_pd;
+    bool            _ultra_pd;
+
+    PHASE           _phase;
+    uint8_t         _hdr[8];                    // opcode and address bytes received
+    uint32_t        _hdr_len;                   // header bytes expected
+    uint32_t        _hdr_count;                 // header bytes received
+    uint32_t        _page;                      // decoded page
+    uint32_t        _offset;                    // current byte within page / buffer / status
+    uint32_t        _linear;                    // current address for continuous reads
+    uint32_t        _data_count;                // data bytes transferred
+
+    uint32_t header_length(uint8_t opcode) const;
+    bool allowed_while_busy(uint8_t opcode) const;
+    void decode_address(void);
+    void start_data(void);
+    uint8_t data_byte(uint8_t mosi);
+    void execute(void);
+    void start_operation(uint64_t typ_us, int buffer);
+    void erase_pages(uint32_t first, uint32_t count);
+    void program_page(uint32_t page, int buffer, bool erase);
+    uint8_t status_byte(int n) const;
+    uint8_t *page_ptr(uint32_t page);
+
+};
+
+#endif // _AT45DBSIM_H_
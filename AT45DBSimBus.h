@@ -0,0 +1,138 @@
+/* 
+ * @file    AT45DBSimBus.h
+ * @brief   Device driver - AT45DB bus policy for the AT45DBSim host model
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+ 
+#ifndef _AT45DBSIMBUS_H_
+#define _AT45DBSIMBUS_H_
+ 
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include "AT45DBSim.h"
+
+/**
+ * AT45DBCore bus policy: the AT45DBSim device model, for host builds.
+ *
+ *   AT45DBSim                  sim;
+ *   AT45DBCore<AT45DBSimBus>   flash(sim);
+ *
+ * Sleeping and the millisecond clock use the model's clock, so waits
+ * take no real time and timings are those of the modelled part.
+ * 'call_ns' adds a fixed cost to every transfer call, standing in for 
+ * the HAL overhead of a real SPI port.
+ */
+class AT45DBSimBus
+{
+
+public:
+
+    /**
+     * @param sim = device model on the other end of the bus
+     * @param call_ns = modelled overhead of each transfer call
+     */
+    AT45DBSimBus(AT45DBSim &sim, uint32_t call_ns = 0) :
+            _sim(sim), _fill(0), _call_ns(call_ns) { }
+
+    void init(uint32_t hz, uint8_t fill)
+    {
+        _sim.deselect();
+        _sim.frequency(hz);
+        _fill = fill;
+    }
+
+    void select(void)
+    {
+        _sim.select();
+    }
+
+    void deselect(void)
+    {
+        _sim.deselect();
+    }
+
+    void transfer(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len)
+    {
+        uint32_t    i;
+
+        _sim.advance_ns(_call_ns);
+        if (rx_len == 0) {
+            _sim.transfer(tx, NULL, tx_len, _fill);
+        } else if (tx_len == 0) {
+            _sim.transfer(NULL, rx, rx_len, _fill);
+        } else {
+            for (i=0; (i<tx_len) || (i<rx_len); i++) {
+                uint8_t miso = _sim.transfer((i < tx_len) ? tx[i] : _fill);
+                if (i < rx_len) {
+                    rx[i] = miso;
+                }
+            }
+        }
+    }
+
+    void wait_us(uint32_t us)
+    {
+        _sim.advance_ns((uint64_t)us * 1000);
+    }
+
+    void sleep_ms(uint32_t ms)
+    {
+        _sim.advance_ns((uint64_t)ms * 1000000);
+    }
+
+    void yield(void)
+    {
+    }
+
+    uint32_t now_ms(void)
+    {
+        return (uint32_t)(_sim.now_ns() / 1000000);
+    }
+
+    uint32_t now_us(void)
+    {
+        return (uint32_t)(_sim.now_ns() / 1000);
+    }
+
+    static void debug(const char *format, ...)
+    {
+#ifndef NDEBUG
+        va_list args;
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+#else
+        (void)format;
+#endif
+    }
+
+    AT45DBSim &sim(void)
+    {
+        return _sim;
+    }
+
+private:
+
+    AT45DBSim       &_sim;
+    uint8_t         _fill;                      // clocked out when only receiving
+    uint32_t        _call_ns;                   // modelled cost of a transfer call
+
+};
+
+#endif // _AT45DBSIMBUS_H_
@@ -0,0 +1,214 @@
+/* 
+ * @file    AT45DBSpidevBus.h
+ * @brief   Device driver - AT45DB bus policy for Linux spidev
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+ 
+#ifndef _AT45DBSPIDEVBUS_H_
+#define _AT45DBSPIDEVBUS_H_
+ 
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#ifndef AT45_SPIDEV_CHUNK
+#define AT45_SPIDEV_CHUNK   4096                // largest single spidev transfer (bufsiz)
+#endif  // AT45_SPIDEV_CHUNK
+
+/**
+ * AT45DBCore bus policy: a Linux spidev node, e.g. "/dev/spidev0.0".
+ *
+ *   AT45DBCore<AT45DBSpidevBus>    flash("/dev/spidev0.0");
+ *
+ * spidev drops CS at the end of each ioctl, but a command here is
+ * several transfers in one CS assertion (header, then data, or a status
+ * poll spread over a sleep). Each transfer is therefore sent with 
+ * cs_change set on its last segment, which asks the controller to leave
+ * CS asserted after the message, and deselect() ends the command with 
+ * an empty transfer that releases it. The SPI controller driver must 
+ * honour cs_change (most native chip select controllers do); otherwise
+ * use a GPIO chip select in the device tree.
+ *
+ * Transfers are split at the spidev buffer size (module parameter 
+ * 'bufsiz', 4096 by default). If the node cannot be opened every 
+ * transfer reads 0xFF and init() finds no device.
+ */
+class AT45DBSpidevBus
+{
+
+public:
+
+    /**
+     * @param path = spidev device node
+     */
+    AT45DBSpidevBus(const char *path) :
+            _fd(open(path, O_RDWR)), _hz(0), _fill(0) { }
+
+    ~AT45DBSpidevBus()
+    {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    void init(uint32_t hz, uint8_t fill)
+    {
+        uint8_t     mode = SPI_MODE_0;
+        uint8_t     bits = 8;
+
+        _hz = hz;
+        _fill = fill;
+        if (_fd >= 0) {
+            ioctl(_fd, SPI_IOC_WR_MODE, &mode);
+            ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+            ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &_hz);
+        }
+        AT45DBSpidevBus::deselect();
+    }
+
+    /*
+     * Assert CS with an empty transfer that keeps it asserted
+     */
+    void select(void)
+    {
+        AT45DBSpidevBus::message(NULL, NULL, 0, true);
+    }
+
+    /*
+     * An empty transfer without cs_change: CS is released at its end
+     */
+    void deselect(void)
+    {
+        AT45DBSpidevBus::message(NULL, NULL, 0, false);
+    }
+
+    void transfer(const uint8_t *tx, uint32_t tx_len, uint8_t *rx, uint32_t rx_len)
+    {
+        uint32_t    len = (tx_len > rx_len) ? tx_len : rx_len;
+        uint32_t    done = 0;
+        uint32_t    n;
+
+        // where tx and rx lengths differ, go through _pad filled with the fill byte
+        while (done < len) {
+            n = len - done;
+            if (n > AT45_SPIDEV_CHUNK) {
+                n = AT45_SPIDEV_CHUNK;
+            }
+            if ((done + n <= tx_len) && ((rx_len == 0) || (done + n <= rx_len))) {
+                AT45DBSpidevBus::message(tx + done, (rx_len != 0) ? rx + done : NULL, n, true);
+            } else {
+                memset(_pad, _fill, n);
+                if (done < tx_len) {
+                    memcpy(_pad, tx + done, (tx_len - done < n) ? tx_len - done : n);
+                }
+                AT45DBSpidevBus::message(_pad, _pad, n, true);
+                if (done < rx_len) {
+                    memcpy(rx + done, _pad, (rx_len - done < n) ? rx_len - done : n);
+                }
+            }
+            done += n;
+        }
+    }
+
+    void wait_us(uint32_t us)
+    {
+        usleep(us);
+    }
+
+    void sleep_ms(uint32_t ms)
+    {
+        usleep(ms * 1000);
+    }
+
+    void yield(void)
+    {
+        sched_yield();
+    }
+
+    /*
+     * Monotonic clock; the 64 bit product also holds with a 32 bit 
+     * time_t, and the result wraps at 2^32 like the other buses' clocks
+     */
+    uint32_t now_ms(void)
+    {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32_t)(((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+    }
+
+    uint32_t now_us(void)
+    {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32_t)(((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+    }
+
+    static void debug(const char *format, ...)
+    {
+#ifndef NDEBUG
+        va_list args;
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+#else
+        (void)format;
+#endif
+    }
+
+private:
+
+    int             _fd;
+    uint32_t        _hz;
+    uint8_t         _fill;                      // clocked out when only receiving
+    uint8_t         _pad[AT45_SPIDEV_CHUNK];    // one chunk of a transfer padded with _fill
+
+    /*
+     * One SPI_IOC_MESSAGE of a single segment; 'hold' leaves CS asserted
+     */
+    void message(const uint8_t *tx, uint8_t *rx, uint32_t len, bool hold)
+    {
+        struct spi_ioc_transfer xfer;
+
+        if (_fd < 0) {
+            if (rx != NULL) {
+                memset(rx, 0xff, len);
+            }
+            return;
+        }
+        memset(&xfer, 0, sizeof(xfer));
+        xfer.tx_buf = (unsigned long)tx;
+        xfer.rx_buf = (unsigned long)rx;
+        xfer.len = len;
+        xfer.speed_hz = _hz;
+        xfer.bits_per_word = 8;
+        xfer.cs_change = hold ? 1 : 0;
+        ioctl(_fd, SPI_IOC_MESSAGE(1), &xfer);
+    }
+
+};
+
+#endif // _AT45DBSPIDEVBUS_H_
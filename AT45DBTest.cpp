@@ -0,0 +1,813 @@
+/* 
+ * @file    AT45DBTest.cpp
+ * @brief   Device driver - AT45DB host regression tests against the simulator
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+/*
+ * Host regression tests: the record log, circular log, flash translation
+ * layer and key-value store each written, read back, remounted and read
+ * back again, and erase/program failures injected with 
+ * AT45DBSim::fail_next_operation(). The driver features (erase tracking
+ * and planning, update, write elision, buffer residency, scatter-gather,
+ * the streaming writer and the coalescer) are checked against both the 
+ * flash contents and the command counts in at45_get_stats(). Each test
+ * runs on a fresh simulated part. Build and run from this directory:
+ *
+ *   g++ -O2 -I. AT45DBTest.cpp AT45DBLog.cpp AT45DBRing.cpp AT45DBFtl.cpp AT45DBKV.cpp AT45DBWriter.cpp AT45DBCoalescer.cpp AT45DBSim.cpp -o at45test && ./at45test
+ *
+ * The exit status is the number of failed tests. On mbed this file 
+ * compiles to nothing.
+ */
+
+#if !defined(__MBED__)
+
+#include <stdio.h>
+#include "AT45DB.h"
+#include "AT45DBCache.h"
+#include "AT45DBLog.h"
+#include "AT45DBRing.h"
+#include "AT45DBFtl.h"
+#include "AT45DBKV.h"
+#include "AT45DBWriter.h"
+#include "AT45DBCoalescer.h"
+
+#define AT45_CHECK(cond)    at45_check((cond), #cond, __LINE__)
+
+static int          checks_failed;
+static uint32_t     seed = 1;
+
+static bool at45_check(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("    line %d: %s\n", line, what);
+        checks_failed++;
+    }
+    return ok;
+}
+
+/*
+ * Repeatable pseudo random numbers (LCG), so a failure can be rerun
+ */
+static uint32_t at45_random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+/*
+ * Record 'id': its length and contents both follow from the id
+ */
+static uint32_t record_make(uint8_t *rec, uint32_t id)
+{
+    uint32_t    len = 8 + (id % 40);
+    uint32_t    i;
+
+    memcpy(rec, &id, sizeof(id));
+    for (i=sizeof(id); i<len; i++) {
+        rec[i] = (uint8_t)(id + i);
+    }
+    return len;
+}
+
+static bool record_check(const uint8_t *rec, uint32_t len, uint32_t id)
+{
+    uint8_t     expect[64];
+
+    return (len == record_make(expect, id)) && (memcmp(rec, expect, len) == 0);
+}
+
+/*
+ * Buffer to main memory programs, with or without erase, since the 
+ * stats were last reset
+ */
+static uint32_t program_count(AT45DB &flash)
+{
+    const at45_stats &stats = flash.at45_get_stats();
+
+    return stats.commands[AT45DB::AT45_BUF1_MEM_ERASE] + stats.commands[AT45DB::AT45_BUF2_MEM_ERASE] + 
+           stats.commands[AT45DB::AT45_BUF1_MEM_NOERASE] + stats.commands[AT45DB::AT45_BUF2_MEM_NOERASE];
+}
+
+/*
+ * Walk a log from the start: the records must be 'first' to 'last' in
+ * order, with their contents intact. Works for AT45DBLog and AT45DBRing.
+ */
+template <class Log>
+static bool records_check(Log &log, uint32_t first, uint32_t last)
+{
+    uint8_t     rec[64];
+    uint32_t    pos = 0;
+    uint32_t    len;
+    uint32_t    id = first;
+
+    while (log.next(pos, rec, sizeof(rec), &len)) {
+        if ((id > last) || !record_check(rec, len, id)) {
+            return 0;
+        }
+        id++;
+    }
+    return id == last + 1;
+}
+
+static void test_log(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    AT45DBLog   log(flash, 0, 64);
+    AT45DBLog   log2(flash, 0, 64);
+    uint8_t     rec[64];
+    uint32_t    id;
+
+    AT45_CHECK(log.format());
+    for (id=0; id<400; id++) {
+        AT45_CHECK(log.append(rec, record_make(rec, id)));
+    }
+    // records still in RAM are read back too
+    AT45_CHECK(records_check(log, 0, 399));
+    AT45_CHECK(log.sync());
+    AT45_CHECK(records_check(log, 0, 399));
+
+    AT45_CHECK(log2.mount());
+    AT45_CHECK(log2.sequence() == log.sequence());
+    AT45_CHECK(records_check(log2, 0, 399));
+    // carry on after the remount
+    for (; id<500; id++) {
+        AT45_CHECK(log2.append(rec, record_make(rec, id)));
+    }
+    AT45_CHECK(log2.sync());
+    AT45_CHECK(log.mount());
+    AT45_CHECK(records_check(log, 0, 499));
+}
+
+static void test_ring(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    AT45DBRing  ring(flash, 0, 4);
+    AT45DBRing  ring2(flash, 0, 4);
+    uint8_t     rec[64];
+    uint32_t    pos, len, first;
+    uint32_t    id;
+
+    AT45_CHECK(ring.format());
+    // several laps of a 4 block ring
+    for (id=0; id<3000; id++) {
+        AT45_CHECK(ring.append(rec, record_make(rec, id)));
+    }
+    AT45_CHECK(ring.sync());
+
+    pos = 0;
+    AT45_CHECK(ring.next(pos, rec, sizeof(rec), &len));
+    memcpy(&first, rec, sizeof(first));
+    AT45_CHECK(first > 0);
+    AT45_CHECK(records_check(ring, first, id - 1));
+
+    AT45_CHECK(ring2.mount());
+    AT45_CHECK(ring2.head() == ring.head());
+    AT45_CHECK(ring2.tail() == ring.tail());
+    AT45_CHECK(records_check(ring2, first, id - 1));
+}
+
+static void test_ftl(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    AT45DBFtl   ftl(flash, 0, 32);
+    AT45DBFtl   ftl2(flash, 0, 32);
+    uint8_t     data[AT45_PAGE_SIZE];
+    uint8_t     back[AT45_PAGE_SIZE];
+    uint32_t    gen[256];
+    uint32_t    used, lpn, i;
+
+    AT45_CHECK(ftl.format());
+    used = ftl.pages() * 3 / 4;
+    if (!AT45_CHECK(used <= sizeof(gen) / sizeof(gen[0]))) {
+        return;
+    }
+    // fill, then hammer a few hot pages so that GC has to move the rest
+    for (i=0; i<used + 4000; i++) {
+        lpn = (i < used) ? i : ((at45_random() % 8) ? at45_random() % 4 : at45_random() % used);
+        gen[lpn] = (i < used) ? 0 : gen[lpn] + 1;
+        memset(data, (uint8_t)lpn, ftl.page_size());
+        memcpy(data, &gen[lpn], sizeof(gen[lpn]));
+        if (!AT45_CHECK(ftl.write(lpn, data))) {
+            return;
+        }
+    }
+    AT45_CHECK(ftl.sync());
+    AT45_CHECK(ftl2.mount());
+
+    for (lpn=0; lpn<used; lpn++) {
+        memset(data, (uint8_t)lpn, ftl.page_size());
+        memcpy(data, &gen[lpn], sizeof(gen[lpn]));
+        AT45_CHECK(ftl.read(lpn, back) && (memcmp(back, data, ftl.page_size()) == 0));
+        AT45_CHECK(ftl2.read(lpn, back) && (memcmp(back, data, ftl.page_size()) == 0));
+    }
+    // never written: reads as erased
+    memset(data, 0xff, ftl.page_size());
+    AT45_CHECK(ftl2.read(used, back) && (memcmp(back, data, ftl.page_size()) == 0));
+}
+
+#define KV_KEYS     200
+
+/*
+ * Shadow of the store: the value of key k is 'len[k]' bytes of 
+ * (k + gen[k] + i), len 0 for a key not present
+ */
+struct kv_shadow {
+    uint32_t    len[KV_KEYS];
+    uint32_t    gen[KV_KEYS];
+};
+
+static void kv_value(uint8_t *value, uint32_t k, uint32_t gen, uint32_t len)
+{
+    uint32_t    i;
+
+    for (i=0; i<len; i++) {
+        value[i] = (uint8_t)(k + gen + i);
+    }
+}
+
+static bool kv_matches(AT45DBKV &kv, const kv_shadow &shadow)
+{
+    char        key[16];
+    uint8_t     value[64];
+    uint8_t     back[64];
+    uint32_t    k, len, count = 0;
+    bool        found;
+
+    for (k=0; k<KV_KEYS; k++) {
+        snprintf(key, sizeof(key), "key/%u", (unsigned)k);
+        found = kv.get(key, back, sizeof(back), &len);
+        if (found != (shadow.len[k] > 0)) {
+            return 0;
+        }
+        if (found) {
+            kv_value(value, k, shadow.gen[k], shadow.len[k]);
+            if ((len != shadow.len[k]) || (memcmp(back, value, len) != 0)) {
+                return 0;
+            }
+            count++;
+        }
+    }
+    return count == kv.count();
+}
+
+static void test_kv(void)
+{
+    AT45DBSim           sim;
+    AT45DB              flash(sim);
+    AT45DBKV            kv(flash, 0, 16);
+    AT45DBKV            kv2(flash, 0, 16);
+    static kv_shadow    shadow;
+    char                key[16];
+    uint8_t             value[64];
+    uint32_t            i, k;
+
+    memset(&shadow, 0, sizeof(shadow));
+    AT45_CHECK(kv.format());
+    // enough updates to wrap the store several times, so compaction runs
+    for (i=0; i<6000; i++) {
+        k = at45_random() % KV_KEYS;
+        snprintf(key, sizeof(key), "key/%u", (unsigned)k);
+        if (at45_random() % 8) {
+            shadow.gen[k]++;
+            shadow.len[k] = 1 + at45_random() % sizeof(value);
+            kv_value(value, k, shadow.gen[k], shadow.len[k]);
+            if (!AT45_CHECK(kv.put(key, value, shadow.len[k]))) {
+                return;
+            }
+        } else {
+            AT45_CHECK(kv.remove(key) == (shadow.len[k] > 0));
+            shadow.len[k] = 0;
+        }
+        if ((i % 16) == 0) {
+            kv.compact(2000);
+        }
+    }
+    AT45_CHECK(kv_matches(kv, shadow));
+    AT45_CHECK(kv.sync());
+    AT45_CHECK(kv2.mount());
+    AT45_CHECK(kv_matches(kv2, shadow));
+}
+
+/*
+ * A failed page program is reported by the cache and the page is kept
+ * dirty, so the next flush writes it
+ */
+static void test_ep_cache(void)
+{
+    AT45DBSim           sim;
+    AT45DB              flash(sim);
+    AT45DBCache<4>      cache(flash);
+    uint8_t             data[AT45_PAGE_SIZE];
+    uint8_t             back[AT45_PAGE_SIZE];
+    uint32_t            page_size = flash.at45_page_size();
+
+    memset(data, 0x5a, page_size);
+    AT45_CHECK(cache.write(0, data, page_size));
+    AT45_CHECK(cache.write(page_size, data, page_size));
+    sim.fail_next_operation();
+    AT45_CHECK(!cache.flush());
+    AT45_CHECK(cache.flush());
+    AT45_CHECK(flash.at45_read(0, back, page_size) && (memcmp(back, data, page_size) == 0));
+    AT45_CHECK(flash.at45_read(page_size, back, page_size) && (memcmp(back, data, page_size) == 0));
+}
+
+/*
+ * Erase and program failures reach the caller of the driver and the
+ * log; the log carries on once the failure has been reported
+ */
+static void test_ep_log(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    AT45DBLog   log(flash, 0, 16);
+    uint8_t     rec[64];
+    uint32_t    page_size = flash.at45_page_size();
+
+    sim.fail_next_operation();
+    AT45_CHECK(flash.at45_erase_range(0, 8 * page_size) == AT45DB::AT45_ERR_EP);
+    AT45_CHECK(flash.at45_erase_range(0, 8 * page_size) == AT45DB::AT45_OK);
+
+    AT45_CHECK(log.format());
+    AT45_CHECK(log.append(rec, record_make(rec, 0)));
+    sim.fail_next_operation();
+    AT45_CHECK(!log.sync());
+    AT45_CHECK(log.append(rec, record_make(rec, 1)));
+    AT45_CHECK(log.sync());
+}
+
+/*
+ * A program failure first seen while reading the ring is still reported
+ * by sync(), and a failed block erase is repeated before the page in it
+ * is programmed
+ */
+static void test_ep_ring(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    AT45DBRing  ring(flash, 0, 4);
+    uint8_t     rec[64];
+    uint32_t    pos, len;
+
+    // the append that fills page 0 starts its program, which fails
+    AT45_CHECK(ring.format());
+    AT45_CHECK(ring.append(rec, record_make(rec, 0)));
+    sim.fail_next_operation();
+    while (ring.head() == 0) {
+        AT45_CHECK(ring.append(rec, record_make(rec, 0)));
+    }
+    pos = 0;
+    ring.next(pos, rec, sizeof(rec), &len);
+    AT45_CHECK(!ring.sync());
+    AT45_CHECK(ring.sync());
+
+    // page 8 starts block 1, which holds old data: its erase fails
+    AT45_CHECK(ring.format());
+    memset(rec, 0x00, sizeof(rec));
+    AT45_CHECK(flash.at45_writepage(8 * flash.at45_page_size(), rec, sizeof(rec)));
+    while (ring.head() < 8) {
+        AT45_CHECK(ring.append(rec, record_make(rec, 1)));
+        AT45_CHECK(ring.sync());
+    }
+    sim.fail_next_operation();
+    AT45_CHECK(ring.append(rec, record_make(rec, 2)));
+    AT45_CHECK(!ring.sync());
+    AT45_CHECK(ring.sync());
+    AT45_CHECK(ring.head() == 9);
+    pos = 8 * flash.at45_page_size();
+    AT45_CHECK(ring.next(pos, rec, sizeof(rec), &len) && record_check(rec, len, 2));
+}
+
+/*
+ * As test_ep_ring for the key-value store: a program failure first seen
+ * by get() is reported by sync(), and a failed block erase is repeated
+ */
+static void test_ep_kv(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    AT45DBKV    kv(flash, 0, 16);
+    uint8_t     value[400];
+    uint8_t     back[400];
+    char        key[16];
+    uint32_t    i, len;
+
+    // one entry per page: putting "b" programs the page holding "a"
+    memset(value, 0x42, sizeof(value));
+    AT45_CHECK(kv.format());
+    AT45_CHECK(kv.put("a", value, sizeof(value)));
+    sim.fail_next_operation();
+    AT45_CHECK(kv.put("b", value, sizeof(value)));
+    kv.get("a", back, sizeof(back), &len);
+    AT45_CHECK(!kv.sync());
+    AT45_CHECK(kv.sync());
+
+    // page 8 starts block 1, which holds old data: its erase fails
+    AT45_CHECK(kv.format());
+    memset(back, 0x00, sizeof(back));
+    AT45_CHECK(flash.at45_writepage(8 * flash.at45_page_size(), back, sizeof(back)));
+    for (i=0; i<8; i++) {
+        snprintf(key, sizeof(key), "k%u", (unsigned)i);
+        AT45_CHECK(kv.put(key, value, sizeof(value)));
+    }
+    AT45_CHECK(kv.sync());
+    sim.fail_next_operation();
+    AT45_CHECK(kv.put("k8", value, sizeof(value)));
+    AT45_CHECK(!kv.sync());
+    AT45_CHECK(kv.sync());
+    AT45_CHECK(kv.get("k8", back, sizeof(back), &len) && (len == sizeof(value)) && 
+               (memcmp(back, value, sizeof(value)) == 0));
+}
+
+/*
+ * at45_update: only the new bytes and the page to buffer transfer cross
+ * the bus, and a failure left by a program of another page does not 
+ * stop the update
+ */
+static void test_update(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    uint8_t     data[AT45_PAGE_SIZE];
+    uint8_t     back[AT45_PAGE_SIZE];
+    uint8_t     patch[16];
+    uint32_t    page_size = flash.at45_page_size();
+    uint32_t    i;
+
+    for (i=0; i<page_size; i++) {
+        data[i] = (uint8_t)i;
+    }
+    AT45_CHECK(flash.at45_writepage(10 * page_size, data, page_size));
+    sim.fail_next_operation();
+    AT45_CHECK(flash.at45_writepage(20 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_ERR_EP);
+
+    memset(patch, 0xa5, sizeof(patch));
+    flash.at45_reset_stats();
+    AT45_CHECK(flash.at45_update(10 * page_size + 100, patch, sizeof(patch)));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+    const at45_stats &stats = flash.at45_get_stats();
+    AT45_CHECK(stats.commands[AT45DB::AT45_PAGE_BUF1_TX] + 
+               stats.commands[AT45DB::AT45_PAGE_BUF2_TX] == 1);
+    AT45_CHECK(stats.bytes < page_size);
+
+    memcpy(&data[100], patch, sizeof(patch));
+    AT45_CHECK(flash.at45_read(10 * page_size, back, page_size) && (memcmp(back, data, page_size) == 0));
+
+    // spanning two pages
+    AT45_CHECK(flash.at45_update(11 * page_size - 8, patch, sizeof(patch)));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+    AT45_CHECK(flash.at45_read(11 * page_size - 8, back, sizeof(patch)) && (memcmp(back, patch, sizeof(patch)) == 0));
+}
+
+/*
+ * Write elision: a page rewritten with the same data is compared, not
+ * programmed, and a failure left by a program of another page does not
+ * stop the next write
+ */
+static void test_elision(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    uint8_t     data[AT45_PAGE_SIZE];
+    uint8_t     back[AT45_PAGE_SIZE];
+    uint32_t    page_size = flash.at45_page_size();
+
+    memset(data, 0x3c, page_size);
+    AT45_CHECK(flash.at45_writepage(10 * page_size, data, page_size));
+    sim.fail_next_operation();
+    AT45_CHECK(flash.at45_writepage(20 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_ERR_EP);
+    flash.at45_set_write_elision(true);
+
+    // unchanged: compared and skipped
+    flash.at45_reset_stats();
+    AT45_CHECK(flash.at45_writepage(10 * page_size, data, page_size));
+    const at45_stats &stats = flash.at45_get_stats();
+    AT45_CHECK(flash.at45_get_elided_writes() == 1);
+    AT45_CHECK(stats.commands[AT45DB::AT45_PAGE_BUF1_CMP] + stats.commands[AT45DB::AT45_PAGE_BUF2_CMP] == 1);
+    AT45_CHECK(program_count(flash) == 0);
+
+    // changed: programmed
+    data[7] = 0x00;
+    AT45_CHECK(flash.at45_writepage(10 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+    AT45_CHECK(flash.at45_get_elided_writes() == 1);
+    AT45_CHECK(flash.at45_get_compared_writes() == 2);
+    AT45_CHECK(program_count(flash) == 1);
+    AT45_CHECK(flash.at45_read(10 * page_size, back, page_size) && (memcmp(back, data, page_size) == 0));
+}
+
+/*
+ * A failed erase leaves its pages unknown, so the next write erases the
+ * page as it programs it rather than programming over the old data
+ */
+static void test_ep_erase_state(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    uint8_t     data[AT45_PAGE_SIZE];
+    uint8_t     back[AT45_PAGE_SIZE];
+    uint32_t    page_size = flash.at45_page_size();
+
+    memset(data, 0x0f, page_size);
+    AT45_CHECK(flash.at45_writepage(2 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+    sim.fail_next_operation();
+    AT45_CHECK(flash.at45_erase_range(0, 8 * page_size) == AT45DB::AT45_ERR_EP);
+    AT45_CHECK(!flash.at45_is_page_erased(2 * page_size));
+
+    memset(data, 0xf0, page_size);
+    AT45_CHECK(flash.at45_writepage(2 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+    AT45_CHECK(flash.at45_read(2 * page_size, back, page_size) && (memcmp(back, data, page_size) == 0));
+}
+
+/*
+ * Erase tracking: a page erased by the driver is programmed without a
+ * second erase (88h/89h), and the data still reads back intact
+ */
+static void test_erase_tracking(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    uint8_t     data[AT45_PAGE_SIZE];
+    uint8_t     back[AT45_PAGE_SIZE];
+    uint32_t    page_size = flash.at45_page_size();
+
+    memset(data, 0x11, page_size);
+    AT45_CHECK(flash.at45_writepage(3 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_erase_range(0, 8 * page_size) == AT45DB::AT45_OK);
+    AT45_CHECK(flash.at45_is_page_erased(3 * page_size));
+
+    flash.at45_reset_stats();
+    memset(data, 0x96, page_size);
+    AT45_CHECK(flash.at45_writepage(3 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+    const at45_stats &stats = flash.at45_get_stats();
+    AT45_CHECK(stats.commands[AT45DB::AT45_BUF1_MEM_NOERASE] + stats.commands[AT45DB::AT45_BUF2_MEM_NOERASE] == 1);
+    AT45_CHECK(program_count(flash) == 1);
+    AT45_CHECK(!flash.at45_is_page_erased(3 * page_size));
+    AT45_CHECK(flash.at45_read(3 * page_size, back, page_size) && (memcmp(back, data, page_size) == 0));
+}
+
+/*
+ * Erase planner: a sector, a block and a page are erased with one 
+ * command each, and every page in the range, and only those, is erased
+ */
+static void test_erase_plan(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    uint8_t     data[AT45_PAGE_SIZE];
+    uint8_t     back[AT45_PAGE_SIZE];
+    uint32_t    page_size = flash.at45_page_size();
+    uint32_t    first = 256;
+    uint32_t    count = 256 + 8 + 1;
+    uint32_t    page;
+
+    // pages 0-7 are block 0, 8-255 sector 0b and 256-511 sector 1
+    memset(data, 0x00, page_size);
+    for (page=first-1; page<=first+count; page++) {
+        AT45_CHECK(flash.at45_writepage(page * page_size, data, page_size));
+    }
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+
+    AT45_CHECK(flash.at45_erase_estimate(first * page_size, count * page_size) > 
+               flash.at45_erase_estimate(first * page_size, page_size));
+    flash.at45_reset_stats();
+    AT45_CHECK(flash.at45_erase_range(first * page_size, count * page_size) == AT45DB::AT45_OK);
+    const at45_stats &stats = flash.at45_get_stats();
+    AT45_CHECK(stats.commands[AT45DB::AT45_SECTOR_ERASE] == 1);
+    AT45_CHECK(stats.commands[AT45DB::AT45_BLOCK_ERASE] == 1);
+    AT45_CHECK(stats.commands[AT45DB::AT45_PAGE_ERASE] == 1);
+
+    for (page=first-1; page<=first+count; page++) {
+        AT45_CHECK(flash.at45_read(page * page_size, back, page_size));
+        memset(data, ((page >= first) && (page < first + count)) ? 0xff : 0x00, page_size);
+        AT45_CHECK(memcmp(back, data, page_size) == 0);
+    }
+}
+
+/*
+ * Buffer residency: a read of a page just written is served from the
+ * SRAM buffer, and once the page is erased it comes from main memory
+ */
+static void test_buffer_residency(void)
+{
+    AT45DBSim   sim;
+    AT45DB      flash(sim);
+    uint8_t     data[AT45_PAGE_SIZE];
+    uint8_t     back[AT45_PAGE_SIZE];
+    uint32_t    page_size = flash.at45_page_size();
+    uint32_t    i;
+
+    for (i=0; i<page_size; i++) {
+        data[i] = (uint8_t)(i * 7);
+    }
+    AT45_CHECK(flash.at45_writepage(30 * page_size, data, page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+
+    flash.at45_reset_stats();
+    AT45_CHECK(flash.at45_read(30 * page_size + 40, back, 64) && (memcmp(back, &data[40], 64) == 0));
+    const at45_stats &stats = flash.at45_get_stats();
+    AT45_CHECK(stats.commands[AT45DB::AT45_BUF1_READ_SER] + stats.commands[AT45DB::AT45_BUF2_READ_SER] + 
+               stats.commands[AT45DB::AT45_BUF1_READ_LF] + stats.commands[AT45DB::AT45_BUF2_READ_LF] == 1);
+    AT45_CHECK(stats.commands[AT45DB::AT45_CONTINUOUS_READ] + stats.commands[AT45DB::AT45_CONTINUOUS_READ_LF] == 0);
+
+    // the buffer copy is stale after an erase
+    AT45_CHECK(flash.at45_erasepage(30 * page_size));
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+    flash.at45_reset_stats();
+    memset(data, 0xff, page_size);
+    AT45_CHECK(flash.at45_read(30 * page_size, back, page_size) && (memcmp(back, data, page_size) == 0));
+    AT45_CHECK(stats.commands[AT45DB::AT45_CONTINUOUS_READ] + stats.commands[AT45DB::AT45_CONTINUOUS_READ_LF] == 1);
+}
+
+/*
+ * Scatter-gather: a page written from several segments and read back
+ * into differently split segments across a page boundary, each in one
+ * command
+ */
+static void test_scatter_gather(void)
+{
+    AT45DBSim           sim;
+    AT45DB              flash(sim);
+    uint8_t             data[2 * AT45_PAGE_SIZE];
+    uint8_t             back[2 * AT45_PAGE_SIZE];
+    uint32_t            page_size = flash.at45_page_size();
+    uint32_t            i;
+
+    for (i=0; i<2*page_size; i++) {
+        data[i] = (uint8_t)at45_random();
+    }
+    for (i=0; i<2; i++) {
+        at45_const_segment  wseg[3] = {
+            { &data[i * page_size], 10 },
+            { &data[i * page_size + 10], page_size - 30 },
+            { &data[i * page_size + page_size - 20], 20 },
+        };
+        flash.at45_reset_stats();
+        AT45_CHECK(flash.at45_writepagev((50 + i) * page_size, wseg, 3));
+        AT45_CHECK(program_count(flash) == 1);
+    }
+    AT45_CHECK(flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) == AT45DB::AT45_OK);
+
+    at45_segment    rseg[3] = {
+        { &back[0], 1 },
+        { &back[1], page_size },
+        { &back[page_size + 1], page_size - 1 },
+    };
+    flash.at45_reset_stats();
+    AT45_CHECK(flash.at45_readv(50 * page_size, rseg, 3));
+    const at45_stats &stats = flash.at45_get_stats();
+    AT45_CHECK(stats.commands[AT45DB::AT45_CONTINUOUS_READ] + stats.commands[AT45DB::AT45_CONTINUOUS_READ_LF] == 1);
+    AT45_CHECK(memcmp(back, data, 2 * page_size) == 0);
+}
+
+/*
+ * AT45DBWriter: a stream of odd sized writes lands in consecutive
+ * pages, one program per page, with the tail padded with FFh
+ */
+static void test_writer(void)
+{
+    AT45DBSim       sim;
+    AT45DB          flash(sim);
+    AT45DBWriter    writer(flash);
+    uint8_t         data[3 * AT45_PAGE_SIZE];
+    uint8_t         back[3 * AT45_PAGE_SIZE];
+    uint32_t        page_size = flash.at45_page_size();
+    uint32_t        len = 2 * page_size + page_size / 2;
+    uint32_t        done, chunk;
+
+    for (done=0; done<len; done++) {
+        data[done] = (uint8_t)at45_random();
+    }
+    memset(&data[len], 0xff, 3 * page_size - len);
+
+    flash.at45_reset_stats();
+    writer.begin(60 * page_size);
+    for (done=0; done<len; done+=chunk) {
+        chunk = 1 + (at45_random() % 100);
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        AT45_CHECK(writer.write(&data[done], chunk));
+    }
+    AT45_CHECK(writer.finish());
+    AT45_CHECK(writer.address() == 63 * page_size);
+    AT45_CHECK(program_count(flash) == 3);
+    AT45_CHECK(flash.at45_read(60 * page_size, back, 3 * page_size) && (memcmp(back, data, 3 * page_size) == 0));
+}
+
+/*
+ * AT45DBCoalescer: records committed early by the deadline are sent
+ * again from the buffer and the page is reprogrammed without an erase,
+ * leaving the earlier records intact
+ */
+static void test_coalescer(void)
+{
+    AT45DBSim           sim;
+    AT45DB              flash(sim);
+    AT45DBCoalescer     coalescer(flash, 10);
+    uint8_t             data[2 * AT45_PAGE_SIZE];
+    uint8_t             back[2 * AT45_PAGE_SIZE];
+    uint32_t            page_size = flash.at45_page_size();
+    uint32_t            i;
+
+    for (i=0; i<2*page_size; i++) {
+        data[i] = (uint8_t)at45_random();
+    }
+    flash.at45_reset_stats();
+    coalescer.begin(70 * page_size);
+    for (i=0; i<3; i++) {
+        AT45_CHECK(coalescer.append(&data[i * 16], 16));
+    }
+    AT45_CHECK(program_count(flash) == 0);
+    sim.advance_ns(20000000);
+    AT45_CHECK(coalescer.poll());
+    AT45_CHECK(program_count(flash) == 1);
+    for (i=3; i<6; i++) {
+        AT45_CHECK(coalescer.append(&data[i * 16], 16));
+    }
+    sim.advance_ns(20000000);
+    AT45_CHECK(coalescer.poll());
+    AT45_CHECK(coalescer.flush());
+    const at45_stats &stats = flash.at45_get_stats();
+    AT45_CHECK(coalescer.programs() == 2);
+    AT45_CHECK(stats.commands[AT45DB::AT45_BUF1_MEM_NOERASE] + stats.commands[AT45DB::AT45_BUF2_MEM_NOERASE] == 2);
+    memset(&data[6 * 16], 0xff, page_size - 6 * 16);
+    AT45_CHECK(flash.at45_read(70 * page_size, back, page_size) && (memcmp(back, data, page_size) == 0));
+
+    // the rest of the page and on into the next
+    for (i=6; i<(page_size + page_size / 2) / 16; i++) {
+        data[i * 16] = (uint8_t)i;
+        AT45_CHECK(coalescer.append(&data[i * 16], 16));
+    }
+    AT45_CHECK(coalescer.flush());
+    AT45_CHECK(coalescer.address() == 71 * page_size + page_size / 2);
+    memset(&data[page_size + page_size / 2], 0xff, page_size / 2);
+    AT45_CHECK(flash.at45_read(70 * page_size, back, 2 * page_size) && (memcmp(back, data, 2 * page_size) == 0));
+}
+
+static const struct {
+    const char  *name;
+    void        (*run)(void);
+} tests[] = {
+    { "log round trip",         test_log },
+    { "ring round trip",        test_ring },
+    { "ftl round trip",         test_ftl },
+    { "kv round trip",          test_kv },
+    { "ep cache flush",         test_ep_cache },
+    { "ep erase and log sync",  test_ep_log },
+    { "ep ring",                test_ep_ring },
+    { "ep kv",                  test_ep_kv },
+    { "update",                 test_update },
+    { "write elision",          test_elision },
+    { "ep erase state",         test_ep_erase_state },
+    { "erase tracking",         test_erase_tracking },
+    { "erase planner",          test_erase_plan },
+    { "buffer residency",       test_buffer_residency },
+    { "scatter-gather",         test_scatter_gather },
+    { "writer",                 test_writer },
+    { "coalescer",              test_coalescer },
+};
+
+int main()
+{
+    uint32_t    i;
+    int         failed = 0;
+    int         before;
+
+    printf("AT45DB host tests, simulated\n");
+    for (i=0; i<sizeof(tests)/sizeof(tests[0]); i++) {
+        before = checks_failed;
+        tests[i].run();
+        printf("%-24s %s\n", tests[i].name, (checks_failed == before) ? "ok" : "FAILED");
+        if (checks_failed != before) {
+            failed++;
+        }
+    }
+    printf("%d of %d failed\n", failed, (int)(sizeof(tests)/sizeof(tests[0])));
+    return failed;
+}
+
+#endif  // __MBED__
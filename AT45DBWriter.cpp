@@ -0,0 +1,115 @@
+/* 
+ * @file    AT45DBWriter.cpp
+ * @brief   Adesto AT45DB pipelined sequential page writer
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include "AT45DBWriter.h"
+
+/*
+ * The AT45DB can accept data into one SRAM buffer while the other is
+ * being programmed into main memory. Page N is therefore programmed
+ * from one buffer while page N+1 is clocked into the other; the only
+ * wait is for page N to finish before page N+1 is committed.
+ *
+ *    SPI:   | load B1 | load B2 |  wait  | load B1 |  wait  |
+ *    flash: |         | prog B1 ...      | prog B2 ...      |
+ */
+
+AT45DBWriter::AT45DBWriter(AT45DB &flash) :
+        _flash(flash), _addr(0), _offset(0), 
+        _buffer(AT45DB::AT45_BUFFER1), _busy(false), _failed(false)
+{
+}
+
+AT45DBWriter::~AT45DBWriter() { }
+
+void AT45DBWriter::begin(uint32_t addr)
+{
+    _addr = addr;
+    _offset = 0;
+    _failed = false;
+}
+
+bool AT45DBWriter::write(const uint8_t *buff, uint32_t size)
+{
+    uint32_t    len;
+
+    while (size > 0) {
+        len = _flash.at45_page_size() - _offset;
+        if (len > size) {
+            len = size;
+        }
+        // the device accepts buffer writes while programming the other buffer
+        _flash.at45_buffer_write(_buffer, _offset, buff, len);
+        _offset += len;
+        buff += len;
+        size -= len;
+        if (_offset == _flash.at45_page_size()) {
+            AT45DBWriter::commit();
+        }
+    }
+    return !_failed;
+}
+
+bool AT45DBWriter::finish(void)
+{
+    uint8_t     pad[16];
+    uint32_t    len;
+
+    if (_offset > 0) {
+        memset(pad, 0xff, sizeof(pad));
+        while (_offset < _flash.at45_page_size()) {
+            len = _flash.at45_page_size() - _offset;
+            if (len > sizeof(pad)) {
+                len = sizeof(pad);
+            }
+            _flash.at45_buffer_write(_buffer, _offset, pad, len);
+            _offset += len;
+        }
+        AT45DBWriter::commit();
+    }
+    AT45DBWriter::wait_programmed();
+    return !_failed;
+}
+
+uint32_t AT45DBWriter::address(void)
+{
+    return _addr;
+}
+
+void AT45DBWriter::wait_programmed(void)
+{
+    if (_busy) {
+        if (_flash.at45_wait_ready(AT45_WAIT_DEFAULT, AT45DB::AT45_OP_ERASE_PROGRAM) != AT45DB::AT45_OK) {
+            _failed = true;
+        }
+        _busy = false;
+    }
+}
+
+void AT45DBWriter::commit(void)
+{
+    // only the buffer to main memory command has to wait for ready
+    AT45DBWriter::wait_programmed();
+    _flash.at45_buffer_program(_buffer, _addr);
+    _busy = true;
+    _addr += _flash.at45_page_size();
+    _offset = 0;
+    _buffer = (_buffer == AT45DB::AT45_BUFFER1) ? AT45DB::AT45_BUFFER2 : AT45DB::AT45_BUFFER1;
+}
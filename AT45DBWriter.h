@@ -0,0 +1,103 @@
+/* 
+ * @file    AT45DBWriter.h
+ * @brief   Adesto AT45DB pipelined sequential page writer
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef _AT45DBWRITER_H_
+#define _AT45DBWRITER_H_
+
+#include "AT45DB.h"
+
+/**
+ * Streaming page writer for bulk sequential writes (log dumps etc.)
+ *
+ * Data is clocked into the idle SRAM buffer while the device is still
+ * programming the previous page from the other buffer. The writer only
+ * waits for ready immediately before issuing the next buffer to main
+ * memory command, so the page program time is hidden behind the SPI
+ * transfer of the next page.
+ *
+ * Pages are written with built-in erase, starting at a page aligned
+ * address and continuing through consecutive pages.
+ */
+class AT45DBWriter
+{
+
+public:
+
+    /**
+     * @param flash = driver for the device to write to
+     */
+    AT45DBWriter(AT45DB &flash);
+
+    ~AT45DBWriter();
+
+    /*
+     * Start a new stream. Any previous stream should be finished first.
+     *
+     * @param addr = address of the first page to write (page aligned)
+     */
+    void begin(uint32_t addr);
+
+    /*
+     * Append data to the stream. Each time a page worth of data has
+     * been collected in the current buffer it is programmed into the
+     * next page and the other buffer becomes current.
+     *
+     * @param *buff = pointer to source in CPU memory space
+     * @param size = number of bytes to append
+     * @return false if an earlier page program failed
+     */
+    bool write(const uint8_t *buff, uint32_t size);
+
+    /*
+     * Pad any partial page with the erased value (FFh), program it and
+     * wait for the last page program to complete.
+     *
+     * @return true = all pages programmed without erase/program error
+     */
+    bool finish(void);
+
+    /*
+     * @return address of the next page to be programmed
+     */
+    uint32_t address(void);
+
+private:
+
+    AT45DB              &_flash;
+    uint32_t            _addr;          // next page to program
+    uint32_t            _offset;        // fill level of the current buffer
+    AT45DB::BUFFERS     _buffer;        // buffer being filled
+    bool                _busy;          // a page program may be in progress
+    bool                _failed;        // an erase/program error was seen
+
+    /*
+     * Wait for the previous page program to finish and record its result
+     */
+    void wait_programmed(void);
+
+    /*
+     * Program the current buffer into the next page and switch buffers
+     */
+    void commit(void);
+
+};
+
+#endif // _AT45DBWRITER_H_